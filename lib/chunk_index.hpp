@@ -0,0 +1,183 @@
+#ifndef CHUNK_INDEX_HPP
+#define CHUNK_INDEX_HPP
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Included after deflate_decompress.hpp (ChunkBoundary), which has no include guard
+
+/** Chunk starts of a gzip stream, to decompress it again without sync nor context propagation
+ * Each entry holds the position of a block in the deflate stream (after the gzip header), the offset of its output in
+ * the decompressed stream, the number of lines before it and the 32KiB of output before it (its context). The first
+ * entry is the start of the stream, without context. Every chunk is then decoded as if it was the first one, and the
+ * chunk holding a given line is known without decompressing (eg. read N of a FASTQ file is line 4N). Optionally, each
+ * entry also holds a sketch of the content of its chunk (see NgramSketch), to only decompress the chunks that may hold
+ * a pattern.
+ *
+ * The index is bound to the gzip file it was built from, by the size of the file and the CRC32 and size in its footer.
+ *
+ * Sidecar file format (.pugzi), integers in little endian:
+ *   "PUGZIDX" and a version byte (3)
+ *   u64 gzip file size, u32 CRC32, u32 ISIZE
+ *   u64 size of the sketches (0 without sketches)
+ *   u64 number of entries, then for each entry: u64 bit position, u64 output offset, u64 number of line feeds before
+ *   the entry, the context (but for the first) and the sketch
+ */
+class ChunkIndex
+{
+  public:
+    static constexpr size_t context_size = ChunkBoundary::context_t::context_size;
+    static constexpr char   magic[8]     = {'P', 'U', 'G', 'Z', 'I', 'D', 'X', 3}; // With the version
+
+    struct entry_t
+    {
+        size_t               bitpos;     /// First block of the chunk in the deflate stream
+        size_t               out_offset; /// Offset of the output of the chunk
+        size_t               lines;      /// Number of line feeds before the chunk
+        std::vector<uint8_t> context;    /// Last 32KiB of output before the chunk (empty for the first chunk)
+        std::vector<uint8_t> sketch;     /// NgramSketch bits of the output of the chunk (empty without sketches)
+    };
+
+    ChunkIndex() = default;
+
+    /// An empty index for the gzip file (in, in_nbytes)
+    ChunkIndex(const byte* in, size_t in_nbytes)
+      : _file_size(in_nbytes)
+      , _footer(footer(in, in_nbytes))
+    {}
+
+    /** Whether the index was built from the gzip file (in, in_nbytes). The chunks must also start within its deflate
+     * stream, which a corrupt index file may not do even with the right file size and footer.
+     */
+    bool matches(const byte* in, size_t in_nbytes) const
+    {
+        if (_entries.empty() || _file_size != in_nbytes || _footer != footer(in, in_nbytes)) return false;
+        InputStream in_stream(in, in_nbytes);
+        return in_stream.consume_header()
+               && _entries.back().bitpos < 8 * (in_stream.available() - GZIP_FOOTER_SIZE);
+    }
+
+    void add(size_t              bitpos,
+             size_t              out_offset,
+             size_t              lines,
+             span<const uint8_t> context,
+             span<const uint8_t> sketch = {})
+    {
+        assert(context.size() == (_entries.empty() ? 0 : context_size));
+        assert(_entries.empty() || sketch.size() == _entries.front().sketch.size());
+        _entries.push_back(
+          {bitpos, out_offset, lines, {context.begin(), context.end()}, {sketch.begin(), sketch.end()}});
+    }
+
+    const std::vector<entry_t>& entries() const { return _entries; }
+
+    bool has_sketches() const { return !_entries.empty() && !_entries.front().sketch.empty(); }
+
+    /** Load an index file, returns false if it can't be read or is not an index. The entries must be consistent: the
+     * first one is the start of the stream, then the bit positions increase and stay within the gzip file, the
+     * output offsets and the line counts don't decrease, and the contexts only hold the characters a decoder accepts
+     * (see Window). Whether they stay within its deflate stream is checked by matches().
+     */
+    bool read(const char* path)
+    {
+        FILE* f = fopen(path, "rb");
+        if (f == nullptr) return false;
+
+        ChunkIndex index;
+        char       file_magic[sizeof(magic)];
+        uint64_t   file_size, sketch_size, nentries;
+        bool       ok = fread(file_magic, sizeof(file_magic), 1, f) == 1
+                  && memcmp(file_magic, magic, sizeof(magic)) == 0 && read_u64(f, file_size)
+                  && read_u64(f, index._footer) && read_u64(f, sketch_size) && read_u64(f, nentries);
+        ok               = ok && (sketch_size == 0 || sketch_size == NgramSketch::size_bytes);
+        ok               = ok && nentries != 0 && nentries == entries_in(remaining_size(f), sketch_size);
+        index._file_size = file_size;
+        for (uint64_t i = 0; ok && i < nentries; i++) {
+            uint64_t             bitpos, out_offset, lines;
+            std::vector<uint8_t> context(i == 0 ? 0 : context_size);
+            std::vector<uint8_t> sketch(sketch_size);
+            ok = read_u64(f, bitpos) && read_u64(f, out_offset) && read_u64(f, lines)
+                 && (context.empty() || fread(context.data(), context.size(), 1, f) == 1)
+                 && (sketch.empty() || fread(sketch.data(), sketch.size(), 1, f) == 1);
+            if (i == 0) {
+                ok = ok && bitpos == 0 && out_offset == 0 && lines == 0;
+            } else {
+                const entry_t& prev = index._entries.back();
+                ok = ok && bitpos > prev.bitpos && bitpos < 8 * file_size && out_offset >= prev.out_offset
+                     && lines >= prev.lines && context_valid(context);
+            }
+            index._entries.push_back({bitpos, out_offset, lines, std::move(context), std::move(sketch)});
+        }
+        ok = ok && fgetc(f) == EOF;
+        fclose(f);
+
+        if (ok) *this = std::move(index);
+        return ok;
+    }
+
+    /// Save the index to a file
+    void write(const char* path) const
+    {
+        FILE* f  = sys::check_ptr(fopen(path, "wb"), "could not create the index file");
+        bool  ok = fwrite(magic, sizeof(magic), 1, f) == 1 && write_u64(f, _file_size) && write_u64(f, _footer)
+                  && write_u64(f, has_sketches() ? NgramSketch::size_bytes : 0) && write_u64(f, _entries.size());
+        for (const auto& entry : _entries) {
+            ok = ok && write_u64(f, entry.bitpos) && write_u64(f, entry.out_offset) && write_u64(f, entry.lines)
+                 && (entry.context.empty() || fwrite(entry.context.data(), entry.context.size(), 1, f) == 1)
+                 && (entry.sketch.empty() || fwrite(entry.sketch.data(), entry.sketch.size(), 1, f) == 1);
+        }
+        ok = fclose(f) == 0 && ok;
+        if (!ok) sys::throw_syserr("could not write the index file");
+    }
+
+  private:
+    /// Number of bytes from the current position to the end of the file (0 if unknown)
+    static uint64_t remaining_size(FILE* f)
+    {
+        const long pos = ftell(f);
+        if (pos < 0 || fseek(f, 0, SEEK_END) != 0) return 0;
+        const long end = ftell(f);
+        if (end < pos || fseek(f, pos, SEEK_SET) != 0) return 0;
+        return uint64_t(end - pos);
+    }
+
+    /// Number of entries stored in size bytes, 0 if it's not a whole number of entries
+    static uint64_t entries_in(uint64_t size, uint64_t sketch_size)
+    {
+        // The first entry has no context
+        const uint64_t entry_size = 3 * sizeof(uint64_t) + sketch_size;
+        if (size < entry_size || (size - entry_size) % (entry_size + context_size) != 0) return 0;
+        return 1 + (size - entry_size) / (entry_size + context_size);
+    }
+
+    /// Whether the context only holds characters, as posted to a ChunkBoundary
+    static bool context_valid(const std::vector<uint8_t>& context)
+    {
+        using context_t = ChunkBoundary::context_t;
+        return std::all_of(context.begin(), context.end(), [](uint8_t c) {
+            return c >= context_t::min_value && c <= context_t::max_value;
+        });
+    }
+
+    /// CRC32 and ISIZE of the gzip footer, as a little endian u64
+    static uint64_t footer(const byte* in, size_t in_nbytes)
+    {
+        uint64_t value = 0;
+        if (in_nbytes >= sizeof(value)) memcpy(&value, in + in_nbytes - sizeof(value), sizeof(value));
+        return value;
+    }
+
+    // Little endian, like the rest of the decoder
+    static bool read_u64(FILE* f, uint64_t& value) { return fread(&value, sizeof(value), 1, f) == 1; }
+    static bool write_u64(FILE* f, uint64_t value) { return fwrite(&value, sizeof(value), 1, f) == 1; }
+
+    size_t               _file_size = 0;
+    uint64_t             _footer    = 0;
+    std::vector<entry_t> _entries   = {};
+};
+
+constexpr char ChunkIndex::magic[8];
+
+#endif // CHUNK_INDEX_HPP
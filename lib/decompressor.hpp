@@ -17,7 +17,6 @@
  * corresponding ENOUGH number!
  */
 #define PRECODE_TABLEBITS 7
-#define LITLEN_TABLEBITS 10
 #define OFFSET_TABLEBITS 8
 
 /*
@@ -34,9 +33,38 @@
  * the worst-case usage of decode table entries.
  */
 #define PRECODE_ENOUGH 128 /* enough 19 7 7	*/
-#define LITLEN_ENOUGH 1334 /* enough 288 10 15	*/
 #define OFFSET_ENOUGH 402  /* enough 32 8 15	*/
 
+/*
+ * The litlen TABLEBITS number is chosen for each stream among a few table
+ * geometries, for which the decoder is instantiated.  A bigger main table
+ * avoids most subtable lookups and holds more literal pairs, but takes more
+ * cache and more time to fill (see DeflateParser::choose_litlen_tablebits()).
+ */
+template<unsigned tablebits> struct litlen_geometry;
+
+template<> struct litlen_geometry<10>
+{
+    static constexpr unsigned tablebits = 10;
+    static constexpr unsigned enough    = 1334; /* enough 288 10 15	*/
+};
+
+template<> struct litlen_geometry<11>
+{
+    static constexpr unsigned tablebits = 11;
+    static constexpr unsigned enough    = 2342; /* enough 288 11 15	*/
+};
+
+template<> struct litlen_geometry<12>
+{
+    static constexpr unsigned tablebits = 12;
+    static constexpr unsigned enough    = 4382; /* enough 288 12 15	*/
+};
+
+#define LITLEN_MIN_TABLEBITS 10
+#define LITLEN_MAX_TABLEBITS 12
+#define LITLEN_ENOUGH litlen_geometry<LITLEN_MAX_TABLEBITS>::enough
+
 /*
  * Type for codeword lengths.
  */
@@ -138,6 +166,20 @@ constexpr uint32_t HUFFDEC_SUBTABLE_POINTER = 0x80000000;
  */
 constexpr uint32_t HUFFDEC_LITERAL = 0x40000000;
 
+/*
+ * This flag is set in the litlen main table entries that decode two literals at
+ * once (see pair_literals()).
+ */
+constexpr uint32_t HUFFDEC_LITERAL_PAIR = 0x20000000;
+
+/* Shift to extract the second literal from a literal pair entry.  */
+constexpr size_t HUFFDEC_SECOND_LITERAL_SHIFT = 16;
+
+/* Shift and mask to extract the codeword length of the first literal from a
+ * literal pair entry.  */
+constexpr size_t   HUFFDEC_FIRST_LENGTH_SHIFT = 24;
+constexpr uint32_t HUFFDEC_FIRST_LENGTH_MASK  = 0xF;
+
 /* Mask for extracting the codeword length from a decode table entry.  */
 constexpr uint32_t HUFFDEC_LENGTH_MASK = 0xFF;
 
@@ -516,22 +558,67 @@ build_precode_decode_table(struct libdeflate_decompressor* d, const might& might
                                              might_tag);
 }
 
-/* Build the decode table for the literal/length code.  */
-template<typename might>
+/*
+ * Pack pairs of literals in the main portion of a litlen decode table: when the
+ * codeword of a literal is followed, within the main table bits, by the whole
+ * codeword of another literal, the entry decodes both.  The bits of a literal
+ * pair entry are defined as follows:
+ *
+ * - Bits 29 -- 30: flags (HUFFDEC_LITERAL and HUFFDEC_LITERAL_PAIR)
+ * - Bits 24 -- 27: codeword length of the first literal
+ * - Bits 16 -- 23: second literal
+ * - Bits 8 -- 15: first literal
+ * - Bits 0 -- 7: codeword length of both literals
+ *
+ * The second codeword of the entry at index i starts at the bit n of i, n being
+ * the codeword length of the first literal, so its entry is at index i >> n.
+ * Going downward, that entry hasn't been paired yet.
+ */
+static inline void
+pair_literals(uint32_t decode_table[], const unsigned table_bits)
+{
+    for (unsigned i = 1U << table_bits; i-- > 0;) {
+        const uint32_t first = decode_table[i];
+        if (!(first & HUFFDEC_LITERAL)) continue;
+
+        const unsigned first_len = first & HUFFDEC_LENGTH_MASK;
+        const uint32_t second    = decode_table[i >> first_len];
+        const unsigned pair_len  = first_len + (second & HUFFDEC_LENGTH_MASK);
+        if (!(second & HUFFDEC_LITERAL) || pair_len > table_bits) continue;
+
+        decode_table[i] = HUFFDEC_LITERAL | HUFFDEC_LITERAL_PAIR | (first_len << HUFFDEC_FIRST_LENGTH_SHIFT)
+                          | ((second >> HUFFDEC_RESULT_SHIFT & 0xFF) << HUFFDEC_SECOND_LITERAL_SHIFT)
+                          | ((first >> HUFFDEC_RESULT_SHIFT & 0xFF) << HUFFDEC_RESULT_SHIFT) | pair_len;
+    }
+}
+
+/* Build the decode table for the literal/length code, with the main table bits
+ * of the geometry.  Literals are paired when the shortest literal codewords are
+ * short enough for pairs to fit in the main table, which is the case for most
+ * text blocks, but never for static blocks.  */
+template<typename geometry, typename might>
 static inline bool
 build_litlen_decode_table(struct libdeflate_decompressor* d, unsigned num_litlen_syms, const might& might_tag)
 {
-    /* When you change TABLEBITS, you must change ENOUGH, and vice versa! */
-    static_assert(LITLEN_TABLEBITS == 10 && LITLEN_ENOUGH == 1334, "invalid TABLEBITS");
-
-    return build_decode_table(d->u.litlen_decode_table,
-                              d->u.l.lens,
-                              num_litlen_syms,
-                              litlen_decode_results,
-                              LITLEN_TABLEBITS,
-                              DEFLATE_MAX_LITLEN_CODEWORD_LEN,
-                              d->working_space,
-                              might_tag);
+    static_assert(geometry::enough <= LITLEN_ENOUGH, "litlen decode table too small for the geometry");
+
+    /* The lengths alias the table, so look at them first */
+    unsigned min_literal_len = DEFLATE_MAX_LITLEN_CODEWORD_LEN;
+    for (unsigned sym = 0; sym < DEFLATE_NUM_LITERALS; sym++)
+        if (d->u.l.lens[sym] != 0 && d->u.l.lens[sym] < min_literal_len) min_literal_len = d->u.l.lens[sym];
+
+    if (!build_decode_table(d->u.litlen_decode_table,
+                            d->u.l.lens,
+                            num_litlen_syms,
+                            litlen_decode_results,
+                            geometry::tablebits,
+                            DEFLATE_MAX_LITLEN_CODEWORD_LEN,
+                            d->working_space,
+                            might_tag))
+        return false;
+
+    if (2 * min_literal_len <= geometry::tablebits) pair_literals(d->u.litlen_decode_table, geometry::tablebits);
+    return true;
 }
 
 /* Build the decode table for the offset code.  */
@@ -563,13 +650,18 @@ using table_builder::build_precode_decode_table;
 using table_builder::HUFFDEC_END_OF_BLOCK_LENGTH;
 using table_builder::HUFFDEC_EXTRA_LENGTH_BITS_MASK;
 using table_builder::HUFFDEC_EXTRA_OFFSET_BITS_SHIFT;
+using table_builder::HUFFDEC_FIRST_LENGTH_MASK;
+using table_builder::HUFFDEC_FIRST_LENGTH_SHIFT;
 using table_builder::HUFFDEC_LENGTH_BASE_SHIFT;
 using table_builder::HUFFDEC_LENGTH_MASK;
 using table_builder::HUFFDEC_LITERAL;
+using table_builder::HUFFDEC_LITERAL_PAIR;
 using table_builder::HUFFDEC_OFFSET_BASE_MASK;
 using table_builder::HUFFDEC_RESULT_SHIFT;
+using table_builder::HUFFDEC_SECOND_LITERAL_SHIFT;
 using table_builder::HUFFDEC_SUBTABLE_POINTER;
 
+template<typename geometry>
 static inline void
 prepare_static(struct libdeflate_decompressor* restrict d)
 {
@@ -588,7 +680,7 @@ prepare_static(struct libdeflate_decompressor* restrict d)
         d->u.l.lens[i] = 5;
 
     assert(build_offset_decode_table(d, DEFLATE_NUM_LITLEN_SYMS, DEFLATE_NUM_OFFSET_SYMS, ShouldSucceed{}));
-    assert(build_litlen_decode_table(d, DEFLATE_NUM_LITLEN_SYMS, ShouldSucceed{}));
+    assert(build_litlen_decode_table<geometry>(d, DEFLATE_NUM_LITLEN_SYMS, ShouldSucceed{}));
 }
 
 #endif // DECOMPRESSOR_HPP
@@ -50,9 +50,13 @@
 #include <pmmintrin.h>
 #include <tmmintrin.h>
 
+#include <algorithm>
+#include <array>
+#include <vector>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <chrono>
 
 #include "common/exceptions.hpp"
 #include "memory.hpp"
@@ -60,9 +64,76 @@
 
 #include "input_stream.hpp"
 #include "decompressor.hpp"
+#include "translate.hpp"
 
 #include "libdeflate.h"
 
+/** A do nothing window for checking the validity of the stream while searching for a block during random access.
+ */
+struct DummyWindow
+{
+    static constexpr unsigned context_bits = 15;
+
+    using char_t                      = uint8_t;
+    static constexpr char_t max_value = char_t('~'), min_value = char_t('\t');
+
+    using wsize_t  = uint_fast32_t; /// Type for positive offset in buffer
+    using wssize_t = int_fast32_t;  /// Type for signed offsets in buffer
+
+    static constexpr wsize_t context_size = wsize_t(1) << context_bits;
+
+    void clear() { _size = 0; }
+
+    wsize_t size() const { return _size; }
+
+    wsize_t available() const { return context_size; }
+
+    bool push(char_t c)
+    {
+        _size++;
+        if (c <= max_value && c >= min_value) {
+            return true;
+        } else {
+            PRINT_DEBUG_DECODING("Non ascii char literal %u\n", unsigned(c));
+            return false;
+        }
+    }
+
+    /* return true if it's a reasonable offset, otherwise false */
+    bool copy_match(wsize_t length, wsize_t offset)
+    {
+        assert(length >= 3);
+        assert(length <= 258);
+        assert(offset != 0);
+        _size += length;
+        if (offset <= context_size) {
+            return true;
+        } else {
+            PRINT_DEBUG_DECODING("invalid LZ77 offset %lu\n", offset);
+            return false;
+        }
+    }
+
+    bool copy(InputStream& in, wsize_t length)
+    {
+        _size += length;
+        if (in.check_ascii(length, min_value, max_value)) {
+            return true;
+        } else {
+            PRINT_DEBUG_DECODING("Non ascii char in uncompressed block\n");
+            return false;
+        }
+    }
+
+    /// Move the 32K context to the start of the buffer
+    size_t flush(DummyWindow&) { return context_size; }
+
+    bool notify_end_block(InputStream&) const { return true; }
+
+  protected:
+    size_t _size = 0;
+};
+
 /** The main class for the deflate decompression
  * Holds the decompressor tables and the input stream, but not the deflate window or output buffers
  */
@@ -73,6 +144,18 @@ class DeflateParser
       : _in_stream(in_stream)
     {}
 
+    /// Decode another stream, keeping the tables and buffers
+    void set_input(const InputStream& in_stream) { _in_stream = InputStream{in_stream}; }
+
+    /// Decode the next blocks with litlen main tables of 2^tablebits entries (see choose_litlen_tablebits())
+    void set_litlen_tablebits(unsigned tablebits)
+    {
+        assert(tablebits >= LITLEN_MIN_TABLEBITS && tablebits <= LITLEN_MAX_TABLEBITS);
+        _litlen_tablebits = tablebits;
+    }
+
+    unsigned litlen_tablebits() const { return _litlen_tablebits; }
+
     enum class block_result : unsigned {
         SUCCESS              = 0, // Success, yet many work remaining
         LAST_BLOCK           = 1, // Last block had just been decoded
@@ -107,9 +190,450 @@ class DeflateParser
         return block_result_strings[static_cast<unsigned>(result)];
     }
 
+    // Finds a new block of decompressed size >= min_block_size bits
+    // between positions [skip, skip+max_bits_skip] in the compressed stream, returns its position (or the end of the
+    // stream if none was found) and leaves the input stream there
+    // Blocks following a stored block (such as the empty ones of flush markers) are looked for first, in the first
+    // stored_scan_bits. Then non final dynamic blocks: the positions are pre-filtered 128 at a time on their block
+    // header, then on their precode and code lengths, before a trial decoding. Non final fixed Huffman blocks, whose
+    // header is too short to filter the positions much, are only tried when no dynamic block was found: their codes
+    // resynchronize within a few codewords, so a position a few bits off an actual block also decodes the end of it.
+    // The block following the decoded one is returned instead, like after a stored block. As any position of a fixed
+    // Huffman block decodes to its end, they are only looked for in the first fixed_scan_bits.
+    size_t find_block(size_t       skip,
+                      const size_t max_bits_skip  = size_t(1) << (3 + 20), // 1MiB
+                      const size_t min_block_size = 1 << 13                // 8KiB
+    )
+    {
+        DummyWindow dummy_win;
+
+        const size_t max_pos = std::min(8 * _in_stream.size(), skip + max_bits_skip);
+
+        const size_t stored_max_pos = std::min(max_pos, skip + stored_scan_bits);
+        const size_t after_stored   = find_after_stored_block(skip, stored_max_pos, min_block_size);
+        if (after_stored != stored_max_pos) return after_stored;
+
+        auto decodes = [&](size_t candidate) {
+            PRINT_DEBUG_DECODING("trying to decode huffman block at %lu\n", candidate);
+            dummy_win.clear();
+            if (!_in_stream.set_position_bits(candidate)) return false; // Too close to the end to be a big block
+            const block_result res = do_block(dummy_win, dummy_win, ShouldFail{});
+            return res == block_result::SUCCESS && dummy_win.size() >= min_block_size;
+        };
+
+        size_t found = scan_block_headers<DEFLATE_BLOCKTYPE_DYNAMIC_HUFFMAN>(skip, max_pos, [&](size_t candidate) {
+            bits128_t words;
+            load_bits(candidate, words);
+            return precode_complete(extract_bits(words, unsigned(candidate % 8) + 3 + 5 + 5))
+                   && dynamic_header_plausible(candidate) && decodes(candidate);
+        });
+        if (found == max_pos) {
+            size_t following    = 0;
+            auto   then_decodes = [&](size_t candidate) {
+                if (!decodes(candidate)) return false;
+                following = _in_stream.position_bits();
+                if (!_in_stream.set_position_bits(following)) return false; // Decoded up to the end of the stream
+                dummy_win.clear();
+                const block_result res = do_block(dummy_win, dummy_win, ShouldFail{});
+                return res == block_result::SUCCESS || res == block_result::LAST_BLOCK;
+            };
+            const size_t fixed_max_pos = std::min(max_pos, skip + fixed_scan_bits);
+            const size_t fixed
+              = scan_block_headers<DEFLATE_BLOCKTYPE_STATIC_HUFFMAN>(skip, fixed_max_pos, then_decodes);
+            if (fixed == fixed_max_pos) return 8 * _in_stream.size();
+            found = following;
+        }
+
+        PRINT_DEBUG("%p Candidate block start at %lubits\n", (void*)this, found);
+        _in_stream.set_position_bits(found);
+        return found;
+    }
+
+    /// Checks the block at bit position pos as find_block() does, and leaves the input stream at its end. The
+    /// decompressed size of the block is stored in out_size. Positions within the last bytes of the stream, where the
+    /// input stream cannot be placed, give NOT_ENOUGH_INPUT.
+    block_result check_block(size_t pos, size_t& out_size)
+    {
+        DummyWindow dummy_win;
+        out_size = 0;
+        if (!_in_stream.set_position_bits(pos)) return block_result::NOT_ENOUGH_INPUT;
+        const block_result res = do_block(dummy_win, dummy_win, ShouldFail{});
+        out_size               = dummy_win.size();
+        return res;
+    }
+
+    size_t position_bits() const { return _in_stream.position_bits(); }
+
+    /** Chooses the litlen table bits for the stream: the table grows while more than 1/subtable_rate_den of the
+     * litlen symbols would need a subtable lookup, as long as the main table takes at most a third of the L1 data
+     * cache (of l1d_size bytes) and an eighth of the L2 cache (of l2_size bytes, shared with the window and the
+     * output). The rate is estimated from the codeword lengths of sampled dynamic blocks (the code space of the long
+     * codewords): the first block, and for big streams the blocks found at a few evenly spaced positions.
+     * Leaves the input stream at an arbitrary position.
+     */
+    unsigned choose_litlen_tablebits(size_t l1d_size, size_t l2_size)
+    {
+        constexpr unsigned ngeometries = LITLEN_MAX_TABLEBITS - LITLEN_MIN_TABLEBITS + 1;
+
+        uint64_t     long_space[ngeometries] = {}; // In units of 2^-DEFLATE_MAX_CODEWORD_LEN, summed over the samples
+        unsigned     nsampled                = 0;
+        const size_t size_bits               = 8 * _in_stream.size();
+        for (unsigned k = 0; k < nsamples; k++) {
+            size_t pos = size_bits / nsamples * k;
+            if (k != 0) {
+                if (size_bits < sampled_min_bits) break;
+                pos = find_block(pos, sample_scan_bits);
+                if (pos >= size_bits) continue;
+            }
+
+            len_t    lens[DEFLATE_NUM_LITLEN_SYMS + DEFLATE_NUM_OFFSET_SYMS];
+            unsigned num_litlen_syms, num_offset_syms;
+            if (!_in_stream.set_position_bits(pos)) continue; // Within the last bytes of the stream
+            _in_stream.ensure_bits<1 + 2>();
+            if (_in_stream.pop_bits<unsigned>(1 + 2) >> 1 != DEFLATE_BLOCKTYPE_DYNAMIC_HUFFMAN) continue;
+            if (!read_code_lens(pos, lens, num_litlen_syms, num_offset_syms)) continue;
+            if (!code_usable(lens, num_litlen_syms)) continue;
+
+            for (unsigned sym = 0; sym < num_litlen_syms; sym++) {
+                for (unsigned g = 0; g < ngeometries; g++) {
+                    if (lens[sym] > LITLEN_MIN_TABLEBITS + g)
+                        long_space[g] += (1u << DEFLATE_MAX_CODEWORD_LEN) >> lens[sym];
+                }
+            }
+            nsampled++;
+        }
+
+        unsigned tablebits = LITLEN_MIN_TABLEBITS;
+        while (tablebits < LITLEN_MAX_TABLEBITS && (sizeof(uint32_t) << (tablebits + 1)) <= l1d_size / 3
+               && (sizeof(uint32_t) << (tablebits + 1)) <= l2_size / 8
+               && long_space[tablebits - LITLEN_MIN_TABLEBITS] * subtable_rate_den
+                    > uint64_t(nsampled) << DEFLATE_MAX_CODEWORD_LEN)
+            tablebits++;
+        PRINT_DEBUG("%u litlen table bits from %u sampled blocks\n", tablebits, nsampled);
+        return tablebits;
+    }
+
+  private:
+    /// Blocks sampled by choose_litlen_tablebits(), streams smaller than sampled_min_bits only have their first block
+    /// sampled. The blocks are looked for in the sample_scan_bits after the sampled positions.
+    static constexpr unsigned nsamples          = 4;
+    static constexpr size_t   sampled_min_bits  = size_t(8) << 22;       // 4MiB
+    static constexpr size_t   sample_scan_bits  = size_t(1) << (3 + 18); // 256KiB
+    static constexpr unsigned subtable_rate_den = 256;
+
+    /// Range where find_block() looks for stored blocks before trying dynamic blocks
+    static constexpr size_t stored_scan_bits = size_t(1) << (3 + 18); // 256KiB
+    /// Range where find_block() looks for fixed Huffman blocks: twice the largest ones zlib writes (32Ki symbols)
+    static constexpr size_t fixed_scan_bits = size_t(1) << (3 + 18); // 256KiB
+
+    /** Finds a stored block header (a LEN == ~NLEN pair) between the bytes of positions [skip, max_pos[, and returns
+     * the position of the following block if it and the next ones decode to min_block_size bytes. The stored block is
+     * known to end exactly there, while the position of its own header is ambiguous (the header is followed by up to 7
+     * bits of padding).
+     * Returns max_pos if there is none.
+     */
+    size_t find_after_stored_block(size_t skip, size_t max_pos, size_t min_block_size)
+    {
+        DummyWindow  dummy_win;
+        const auto*  data     = reinterpret_cast<const uint8_t*>(_in_stream.data.begin());
+        const size_t size     = _in_stream.size();
+        const size_t max_byte = max_pos / 8;
+
+        // LEN is after the header and its padding, at least a byte after skip
+        for (size_t start = skip / 8 + 1; start < max_byte && start + 4 <= size;) {
+            uint32_t found = 0; // Bit i is set if the LEN/NLEN pair starts at byte start + i
+            if (start + 16 + 3 <= size) {
+                // Compares the 16bits words at offsets 2k and 2k+2, then 2k+1 and 2k+3
+                const __m128i ones = _mm_set1_epi16(-1);
+                for (unsigned odd = 0; odd < 2; odd++) {
+                    const __m128i len  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + start + odd));
+                    const __m128i nlen = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + start + odd + 2));
+                    const uint32_t pairs = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_xor_si128(len, nlen), ones)));
+                    for (unsigned k = 0; k < 8; k++)
+                        found |= ((pairs >> (2 * k)) & 1u) << (2 * k + odd);
+                }
+            } else {
+                for (unsigned i = 0; i < 16 && start + i + 4 <= size; i++) {
+                    const uint16_t len  = uint16_t(data[start + i] | data[start + i + 1] << 8);
+                    const uint16_t nlen = uint16_t(data[start + i + 2] | data[start + i + 3] << 8);
+                    found |= uint32_t(len == uint16_t(~nlen)) << i;
+                }
+            }
+
+            for (; found != 0; found &= found - 1) {
+                const size_t len_byte = start + unsigned(__builtin_ctz(found));
+                if (len_byte >= max_byte) break;
+                const size_t len  = size_t(data[len_byte] | data[len_byte + 1] << 8);
+                const size_t next = len_byte + 4 + len;
+                if (next >= size) continue;
+
+                // The stored data must be text
+                bool ascii = true;
+                for (size_t i = len_byte + 4; i < next && ascii; i++)
+                    ascii = data[i] >= DummyWindow::min_value && data[i] <= DummyWindow::max_value;
+                if (!ascii) continue;
+
+                // Flush markers are often followed by small blocks: the next blocks are decoded up to min_block_size
+                if (!_in_stream.set_position_bits(8 * next)) continue;
+                block_result res;
+                dummy_win.clear();
+                do {
+                    res = do_block(dummy_win, dummy_win, ShouldFail{});
+                } while (res == block_result::SUCCESS && dummy_win.size() < min_block_size);
+                if (res == block_result::SUCCESS) {
+                    PRINT_DEBUG("%p Block start after stored block at %lubits\n", (void*)this, 8 * next);
+                    _in_stream.set_position_bits(8 * next);
+                    return 8 * next;
+                }
+            }
+            start += 16;
+        }
+        return max_pos;
+    }
+
+    using bits128_t = uint64_t[2];
+
+    /// The 64 * N bits of the input stream from the byte of bit position pos, zero past the end of the stream
+    template<size_t N> void load_bits(size_t pos, uint64_t (&words)[N]) const
+    {
+        const size_t start = pos / 8;
+        std::fill(std::begin(words), std::end(words), 0);
+        if (likely(start + sizeof(words) <= _in_stream.size())) {
+            memcpy(words, _in_stream.data.begin() + start, sizeof(words)); // Little endian, like the bit buffer
+        } else if (start < _in_stream.size()) {
+            memcpy(words, _in_stream.data.begin() + start, _in_stream.size() - start);
+        }
+    }
+
+    /// 64 bits from the bit "shift" (< 64) of the words
+    static uint64_t extract_bits(const bits128_t& words, unsigned shift)
+    {
+        return shift == 0 ? words[0] : (words[0] >> shift) | (words[1] << (64 - shift));
+    }
+
+    /** Bit-sliced filter of the 128 positions from pos, 64 per SSE2 lane: bit i of candidates[j] is set if position
+     * pos + 64j + i could start a non final block of type btype. The header of a dynamic block must also have
+     * HLIT<=29 and HDIST<=29.
+     */
+    template<unsigned btype> void header_candidates(size_t pos, uint64_t (&candidates)[2]) const
+    {
+        uint64_t words[3];
+        load_bits(pos, words);
+        const __m128i low  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words));
+        const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + 1));
+        const __m128i ones = _mm_set1_epi32(-1);
+        // Bit i of lane j of header(k) is the k-th bit of a block header starting at pos + 64j + i. The 64 bits shift
+        // of the first bit of a byte aligned position gives 0.
+        auto header = [&](unsigned k) {
+            const int shift = int(pos % 8 + k);
+            return _mm_or_si128(_mm_srl_epi64(low, _mm_cvtsi32_si128(shift)),
+                                _mm_sll_epi64(high, _mm_cvtsi32_si128(64 - shift)));
+        };
+        auto bit_is = [&](unsigned k, bool set) { return set ? header(k) : _mm_xor_si128(header(k), ones); };
+
+        // BFINAL=0, BTYPE (LSB first)
+        __m128i mask = _mm_andnot_si128(header(0), _mm_and_si128(bit_is(1, btype & 1), bit_is(2, btype & 2)));
+        if (btype == DEFLATE_BLOCKTYPE_DYNAMIC_HUFFMAN) {
+            auto all_set = [&](unsigned k) {
+                return _mm_and_si128(_mm_and_si128(header(k), header(k + 1)),
+                                     _mm_and_si128(header(k + 2), header(k + 3)));
+            };
+            mask = _mm_andnot_si128(all_set(4), mask); // HLIT is not 30 or 31
+            mask = _mm_andnot_si128(all_set(9), mask); // HDIST is not 30 or 31
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(candidates), mask);
+    }
+
+    /// Calls try_block() on the positions of [skip, max_pos[ that pass header_candidates<btype>(), in order, until it
+    /// returns true. Returns that position, or max_pos.
+    template<unsigned btype, typename TryBlock>
+    size_t scan_block_headers(size_t skip, size_t max_pos, TryBlock&& try_block)
+    {
+        for (size_t pos = skip; pos < max_pos; pos += 128) {
+            uint64_t candidates[2];
+            header_candidates<btype>(pos, candidates);
+            for (unsigned lane = 0; lane < 2 && pos + 64 * lane < max_pos; lane++) {
+                const size_t lane_pos = pos + 64 * lane;
+                uint64_t     mask     = candidates[lane];
+                if (max_pos - lane_pos < 64) mask &= (uint64_t(1) << (max_pos - lane_pos)) - 1;
+
+                for (; mask != 0; mask &= mask - 1) {
+                    const size_t candidate = lane_pos + unsigned(__builtin_ctzll(mask));
+                    if (try_block(candidate)) return candidate;
+                }
+            }
+        }
+        return max_pos;
+    }
+
+    /** Whether HCLEN and the precode lengths that follow (in the low bits of "bits") make a precode that
+     * build_precode_decode_table() accepts and that can encode a block: complete, or a single codeword of length 1
+     */
+    static bool precode_complete(uint64_t bits)
+    {
+        const unsigned num_explicit_precode_lens = unsigned(bits & 0xF) + 4;
+        bits >>= 4;
+
+        unsigned kraft_sum = 0, num_codewords = 0; // In units of 2^-DEFLATE_MAX_PRE_CODEWORD_LEN
+        for (unsigned i = 0; i < num_explicit_precode_lens; i++, bits >>= 3) {
+            const unsigned len = unsigned(bits & 0x7);
+            if (len == 0) continue;
+            kraft_sum += (1u << DEFLATE_MAX_PRE_CODEWORD_LEN) >> len;
+            num_codewords++;
+        }
+        return kraft_sum == (1u << DEFLATE_MAX_PRE_CODEWORD_LEN)
+               || (num_codewords == 1 && kraft_sum == (1u << (DEFLATE_MAX_PRE_CODEWORD_LEN - 1)));
+    }
+
+    /// The order in which precode lengths are stored
+    static unsigned precode_lens_permutation(unsigned i)
+    {
+        static constexpr uint8_t permutation[DEFLATE_NUM_PRECODE_SYMS]
+          = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+        return permutation[i];
+    }
+
+    /// A precode decoded one bit at a time, without decode table (as in zlib's puff)
+    class canonical_precode
+    {
+      public:
+        explicit canonical_precode(const len_t (&lens)[DEFLATE_NUM_PRECODE_SYMS])
+        {
+            for (len_t len : lens)
+                _count[len]++;
+            unsigned offsets[DEFLATE_MAX_PRE_CODEWORD_LEN + 1] = {0, 0};
+            for (unsigned len = 1; len < DEFLATE_MAX_PRE_CODEWORD_LEN; len++)
+                offsets[len + 1] = offsets[len] + _count[len];
+            for (unsigned sym = 0; sym < DEFLATE_NUM_PRECODE_SYMS; sym++) {
+                if (lens[sym] != 0) _symbols[offsets[lens[sym]]++] = uint8_t(sym);
+            }
+        }
+
+        /// Decode a symbol, the input must have DEFLATE_MAX_PRE_CODEWORD_LEN bits available. Returns -1 if invalid.
+        int decode(InputStream& in_stream) const
+        {
+            unsigned code = 0, first = 0, index = 0;
+            for (unsigned len = 1; len <= DEFLATE_MAX_PRE_CODEWORD_LEN; len++) {
+                code |= in_stream.pop_bits<unsigned>(1);
+                if (code - first < _count[len]) return _symbols[index + code - first];
+                index += _count[len];
+                first = (first + _count[len]) << 1;
+                code <<= 1;
+            }
+            return -1;
+        }
+
+      private:
+        unsigned _count[DEFLATE_MAX_PRE_CODEWORD_LEN + 1] = {};
+        uint8_t  _symbols[DEFLATE_NUM_PRECODE_SYMS]       = {};
+    };
+
+    /// Whether build_decode_table() accepts the code: complete, empty or a single codeword of length 1
+    static bool code_usable(const len_t* lens, unsigned num_syms)
+    {
+        uint32_t kraft_sum = 0, num_codewords = 0; // In units of 2^-DEFLATE_MAX_CODEWORD_LEN
+        for (unsigned sym = 0; sym < num_syms; sym++) {
+            if (lens[sym] == 0) continue;
+            kraft_sum += (1u << DEFLATE_MAX_CODEWORD_LEN) >> lens[sym];
+            num_codewords++;
+        }
+        return kraft_sum == (1u << DEFLATE_MAX_CODEWORD_LEN) || kraft_sum == 0
+               || (num_codewords == 1 && kraft_sum == (1u << (DEFLATE_MAX_CODEWORD_LEN - 1)));
+    }
+
+    /** Checks the code lengths of a candidate dynamic block at pos (with a complete precode), cheapest first and
+     * without building any decode table:
+     *  1. the run-length encoded lengths don't overrun the litlen and offset codes,
+     *  2. both codes are usable by build_decode_table(),
+     *  3. the end of block has a codeword and the literals outside of the DummyWindow range don't take most of the
+     *     literal code space. Encoders give codewords to the literals they use (some static tables give all of them a
+     *     long codeword), so text blocks pass while random bits rarely do.
+     */
+    bool dynamic_header_plausible(size_t pos)
+    {
+        len_t    lens[DEFLATE_NUM_LITLEN_SYMS + DEFLATE_NUM_OFFSET_SYMS];
+        unsigned num_litlen_syms, num_offset_syms;
+
+        // 1. Run-length overruns
+        if (!read_code_lens(pos, lens, num_litlen_syms, num_offset_syms)) return false;
+
+        // 2. Completeness
+        if (!code_usable(lens, num_litlen_syms) || !code_usable(lens + num_litlen_syms, num_offset_syms)) return false;
+
+        // 3. Literal alphabet
+        if (lens[DEFLATE_END_OF_BLOCK] == 0) return false;
+        uint32_t in_range = 0, out_of_range = 0; // Code space of the literals, in units of 2^-DEFLATE_MAX_CODEWORD_LEN
+        for (unsigned sym = 0; sym < 256; sym++) {
+            if (lens[sym] == 0) continue;
+            const uint32_t code_space = (1u << DEFLATE_MAX_CODEWORD_LEN) >> lens[sym];
+            if (sym >= DummyWindow::min_value && sym <= DummyWindow::max_value) {
+                in_range += code_space;
+            } else {
+                out_of_range += code_space;
+            }
+        }
+        return out_of_range <= in_range;
+    }
+
+    /// Reads the litlen and offset code lengths of the dynamic block at pos (with a complete precode) without building
+    /// any decode table. Returns false if the run-length encoded lengths overrun the codes, or if the header is within
+    /// the last bytes of the stream, where the input stream cannot be placed.
+    bool read_code_lens(size_t pos, len_t* lens, unsigned& num_litlen_syms, unsigned& num_offset_syms)
+    {
+        if (!_in_stream.set_position_bits(pos + 3)) return false;
+        _in_stream.ensure_bits<5 + 5 + 4>();
+        num_litlen_syms                          = _in_stream.pop_bits<unsigned>(5) + 257;
+        num_offset_syms                          = _in_stream.pop_bits<unsigned>(5) + 1;
+        const unsigned num_explicit_precode_lens = _in_stream.pop_bits<unsigned>(4) + 4;
+
+        len_t precode_lens[DEFLATE_NUM_PRECODE_SYMS] = {};
+        _in_stream.ensure_bits<DEFLATE_NUM_PRECODE_SYMS * 3>();
+        for (unsigned i = 0; i < num_explicit_precode_lens; i++)
+            precode_lens[precode_lens_permutation(i)] = _in_stream.pop_bits<len_t>(3);
+        const canonical_precode precode{precode_lens};
+
+        const unsigned num_lens = num_litlen_syms + num_offset_syms;
+        for (unsigned i = 0; i < num_lens;) {
+            _in_stream.ensure_bits<DEFLATE_MAX_PRE_CODEWORD_LEN + 7>();
+            const int presym = precode.decode(_in_stream);
+            if (presym < 0) return false;
+            if (presym < 16) {
+                lens[i++] = len_t(presym);
+                continue;
+            }
+
+            len_t    rep_len = 0;
+            unsigned rep_count;
+            if (presym == 16) {
+                if (i == 0) return false; // Nothing to repeat
+                rep_len   = lens[i - 1];
+                rep_count = 3 + _in_stream.pop_bits<unsigned>(2);
+            } else if (presym == 17) {
+                rep_count = 3 + _in_stream.pop_bits<unsigned>(3);
+            } else {
+                rep_count = 11 + _in_stream.pop_bits<unsigned>(7);
+            }
+            if (rep_count > num_lens - i) return false;
+            for (; rep_count > 0; rep_count--)
+                lens[i++] = rep_len;
+        }
+        return true;
+    }
+
   protected:
     template<typename Window, typename Sink, typename Might = ShouldSucceed>
     block_result do_block(Window& window, Sink& sink, const Might& might_tag = {})
+    {
+        switch (_litlen_tablebits) {
+            case 11: return decode_block<litlen_geometry<11>>(window, sink, might_tag);
+            case 12: return decode_block<litlen_geometry<12>>(window, sink, might_tag);
+            default: return decode_block<litlen_geometry<10>>(window, sink, might_tag);
+        }
+    }
+
+  private:
+    template<typename Geometry, typename Window, typename Sink, typename Might>
+    block_result decode_block(Window& window, Sink& sink, const Might& might_tag)
     {
 
         /* Starting to read the next block.  */
@@ -122,7 +646,7 @@ class DeflateParser
         const libdeflate_decompressor* cur_d;
         switch (_in_stream.pop_bits<uint8_t>(2)) {
             case DEFLATE_BLOCKTYPE_DYNAMIC_HUFFMAN:
-                if (might_tag.fail_if(!prepare_dynamic(might_tag))) return block_result::INVALID_DYNAMIC_HT;
+                if (might_tag.fail_if(!prepare_dynamic<Geometry>(might_tag))) return block_result::INVALID_DYNAMIC_HT;
                 cur_d = &_decompressor;
                 break;
 
@@ -132,7 +656,7 @@ class DeflateParser
 
                 return success;
 
-            case DEFLATE_BLOCKTYPE_STATIC_HUFFMAN: cur_d = &static_decompressor; break;
+            case DEFLATE_BLOCKTYPE_STATIC_HUFFMAN: cur_d = &static_decompressor<Geometry>(); break;
 
             default: return block_result::INVALID_BLOCK_TYPE;
         }
@@ -142,10 +666,24 @@ class DeflateParser
             /* Decode a litlen symbol.  */
             _in_stream.ensure_bits<DEFLATE_MAX_LITLEN_CODEWORD_LEN>();
             // FIXME: entry should be const
-            uint32_t entry = cur_d->u.litlen_decode_table[_in_stream.bits<uint16_t>(LITLEN_TABLEBITS)];
+            uint32_t entry = cur_d->u.litlen_decode_table[_in_stream.bits<uint16_t>(Geometry::tablebits)];
+            if (entry & HUFFDEC_LITERAL_PAIR) {
+                /* Two literals (common case for text)  */
+                if (likely(window.available() >= 2)) {
+                    _in_stream.remove_bits(entry & HUFFDEC_LENGTH_MASK);
+                    if (might_tag.fail_if(!window.push(uint8_t(entry >> HUFFDEC_RESULT_SHIFT))
+                                          || !window.push(uint8_t(entry >> HUFFDEC_SECOND_LITERAL_SHIFT)))) {
+                        return block_result::INVALID_LITERAL;
+                    }
+                    continue;
+                }
+                /* Only the first one fits before flushing  */
+                entry = HUFFDEC_LITERAL | (entry & (0xFF << HUFFDEC_RESULT_SHIFT))
+                        | (entry >> HUFFDEC_FIRST_LENGTH_SHIFT & HUFFDEC_FIRST_LENGTH_MASK);
+            }
             if (entry & HUFFDEC_SUBTABLE_POINTER) {
                 /* Litlen subtable required (uncommon case)  */
-                _in_stream.remove_bits(LITLEN_TABLEBITS);
+                _in_stream.remove_bits(Geometry::tablebits);
                 entry = cur_d->u.litlen_decode_table[((entry >> HUFFDEC_RESULT_SHIFT) & 0xFFFF)
                                                      + _in_stream.bits(entry & HUFFDEC_LENGTH_MASK)];
             }
@@ -215,14 +753,9 @@ class DeflateParser
         }
     }
 
-  private:
-    template<typename Might = ShouldSucceed> bool prepare_dynamic(const Might& might_tag = {})
+    template<typename Geometry, typename Might> bool prepare_dynamic(const Might& might_tag)
     {
 
-        /* The order in which precode lengths are stored.  */
-        static constexpr uint8_t deflate_precode_lens_permutation[DEFLATE_NUM_PRECODE_SYMS]
-          = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
-
         /* Read the codeword length counts.  */
         unsigned       num_litlen_syms           = _in_stream.pop_bits<unsigned>(5) + 257;
         unsigned       num_offset_syms           = _in_stream.pop_bits<unsigned>(5) + 1;
@@ -232,10 +765,10 @@ class DeflateParser
         _in_stream.ensure_bits<DEFLATE_NUM_PRECODE_SYMS * 3>();
 
         for (unsigned i = 0; i < num_explicit_precode_lens; i++)
-            _decompressor.u.precode_lens[deflate_precode_lens_permutation[i]] = _in_stream.pop_bits<len_t>(3);
+            _decompressor.u.precode_lens[precode_lens_permutation(i)] = _in_stream.pop_bits<len_t>(3);
 
         for (unsigned i = num_explicit_precode_lens; i < DEFLATE_NUM_PRECODE_SYMS; i++)
-            _decompressor.u.precode_lens[deflate_precode_lens_permutation[i]] = 0;
+            _decompressor.u.precode_lens[precode_lens_permutation(i)] = 0;
 
         /* Build the decode table for the precode.  */
         if (might_tag.fail_if(!build_precode_decode_table(&_decompressor, might_tag))) return false;
@@ -320,7 +853,7 @@ class DeflateParser
               "fail at build_offset_decode_table(_decompressor, num_litlen_syms, num_offset_syms)\n");
             return false;
         }
-        if (!build_litlen_decode_table(&_decompressor, num_litlen_syms, might_tag)) {
+        if (!build_litlen_decode_table<Geometry>(&_decompressor, num_litlen_syms, might_tag)) {
             PRINT_DEBUG_DECODING(
               "fail at build_litlen_decode_table(_decompressor, num_litlen_syms, num_offset_syms)\n");
             return false;
@@ -365,19 +898,24 @@ class DeflateParser
     InputStream _in_stream;
 
   private:
-    static inline struct libdeflate_decompressor make_static_decompressor()
+    /// The tables of static blocks, for each geometry
+    template<typename Geometry> static const libdeflate_decompressor& static_decompressor()
+    {
+        static const libdeflate_decompressor sd = make_static_decompressor<Geometry>();
+        return sd;
+    }
+
+    template<typename Geometry> static inline struct libdeflate_decompressor make_static_decompressor()
     {
         struct libdeflate_decompressor sd;
-        prepare_static(&sd);
+        prepare_static<Geometry>(&sd);
         return sd;
     }
 
-    static const libdeflate_decompressor static_decompressor;
-    struct libdeflate_decompressor       _decompressor = {};
+    struct libdeflate_decompressor _decompressor     = {};
+    unsigned                       _litlen_tablebits = LITLEN_MIN_TABLEBITS;
 };
 
-const libdeflate_decompressor DeflateParser::static_decompressor = DeflateParser::make_static_decompressor();
-
 namespace details {
 
 /// Unrolled loops through template recurssion
@@ -642,116 +1180,166 @@ template<typename _char_t = char, unsigned _context_bits = 15> class Window
     char_t*           _last_flush_end;
 };
 
-/** A do nothing window for checking the validity of the stream while searching for a block during random access.
+/** Window that flush its content to a buffer
+ * Cache lines are flushed with streaming non-temporal store using the write combining buffer
  */
-struct DummyWindow
+template<typename char_t> class SinkBuffer : public span<char_t>
 {
-    static constexpr unsigned context_bits = 15;
+  private:
+    static constexpr size_t cache_line_size = details::cache_line_size;
+    static_assert(cache_line_size % sizeof(char_t) == 0, "A integer number of char_t should fits in cache line");
 
-    using char_t                      = uint8_t;
-    static constexpr char_t max_value = char_t('~'), min_value = char_t('\t');
+  public:
+    SinkBuffer(span<char_t> buf)
+      : span<char_t>(buf)
+    {}
 
-    using wsize_t  = uint_fast32_t; /// Type for positive offset in buffer
-    using wssize_t = int_fast32_t;  /// Type for signed offsets in buffer
+    size_t operator()(span<char_t> data)
+    {
+        const size_t sz = size_t(::details::round_down<cache_line_size>(data.end()) - data.begin());
+        if (unlikely(sz > this->size())) return 0;
 
-    static constexpr wsize_t context_size = wsize_t(1) << context_bits;
+        char_t* dst = this->begin();
+        this->pop_front(sz);
 
-    void clear() { _size = 0; }
+        details::stream_memcpy(dst, data.begin(), sz * sizeof(char_t));
+        return sz;
+    }
 
-    wsize_t size() const { return _size; }
+    /// Copy the remaining data at the end of decompression, returns the remaining buffer space aligned to the next
+    /// cache line
+    span<char_t> final_flush(Window<char_t>& window)
+    { // We're leaving together
+        span<char_t> last_flush = window.flushable();
+        size_t       sz         = last_flush.size();
+        if (unlikely(sz > this->size())) return {}; // Not enough space
 
-    wsize_t available() const { return context_size; }
+        memcpy(this->begin(), last_flush.begin(), sz * sizeof(char_t));
+        this->pop_front(sz);
 
-    bool push(char_t c)
+        return {::details::round_up<cache_line_size>(this->begin()), this->end()};
+    }
+
+    // Return a pointer after the last written symbol in the buffer
+    char_t* buf_ptr() const { return this->begin(); }
+};
+
+/// Accumulates the time a chunk spends blocked on other chunks (context hand-off, ordered output), so that only the
+/// actual decoding time is accounted when measuring the decoding speed
+class WaitClock
+{
+  public:
+    using clock = std::chrono::steady_clock;
+
+    static clock::time_point now() { return clock::now(); }
+    void                     stop(clock::time_point started) { _waited += clock::now() - started; }
+
+    /// Return the accumulated time and reset it
+    clock::duration take()
     {
-        _size++;
-        if (c <= max_value && c >= min_value) {
-            return true;
-        } else {
-            PRINT_DEBUG_DECODING("Non ascii char literal %u\n", unsigned(c));
-            return false;
-        }
+        clock::duration waited = _waited;
+        _waited                = clock::duration::zero();
+        return waited;
     }
 
-    /* return true if it's a reasonable offset, otherwise false */
-    bool copy_match(wsize_t length, wsize_t offset)
-    {
-        assert(length >= 3);
-        assert(length <= 258);
-        assert(offset != 0);
-        _size += length;
-        if (offset <= context_size) {
-            return true;
-        } else {
-            PRINT_DEBUG_DECODING("invalid LZ77 offset %lu\n", offset);
-            return false;
-        }
-    }
+  private:
+    clock::duration _waited = clock::duration::zero();
+};
 
-    bool copy(InputStream& in, wsize_t length)
-    {
-        _size += length;
-        if (in.check_ascii(length, min_value, max_value)) {
-            return true;
+/// Number of line feeds in data
+static inline size_t
+count_newlines(span<const uint8_t> data)
+{
+    size_t         count = 0;
+    const uint8_t* p     = data.begin();
+    const uint8_t* e     = data.end();
+
+    for (;;) {
+        p = static_cast<const uint8_t*>(memchr(p, static_cast<int>('\n'), size_t(e - p)));
+        if (p != nullptr) {
+            count += 1;
+            p++;
         } else {
-            PRINT_DEBUG_DECODING("Non ascii char in uncompressed block\n");
-            return false;
+            break;
         }
     }
+    return count;
+}
 
-    /// Move the 32K context to the start of the buffer
-    size_t flush(DummyWindow&) { return context_size; }
-
-    bool notify_end_block(InputStream&) const { return true; }
-
-  protected:
-    size_t _size = 0;
-};
-
-/** Window that flush its content to a buffer
- * Cache lines are flushed with streaming non-temporal store using the write combining buffer
+/** Set of the 4-grams of a text, as a Bloom filter with a single hash function (64KiB)
+ * A pattern may be in the text only if all its 4-grams are in the set (patterns shorter than a 4-gram always may).
+ * The text is added as a stream, the 4-grams spanning two texts are added to the first one with add_boundary().
  */
-template<typename char_t> class SinkBuffer : public span<char_t>
+class NgramSketch
 {
-  private:
-    static constexpr size_t cache_line_size = details::cache_line_size;
-    static_assert(cache_line_size % sizeof(char_t) == 0, "A integer number of char_t should fits in cache line");
-
   public:
-    SinkBuffer(span<char_t> buf)
-      : span<char_t>(buf)
+    static constexpr unsigned ngram_size = 4;
+    static constexpr unsigned hash_bits  = 19;
+    static constexpr size_t   size_bytes = (size_t(1) << hash_bits) / 8;
+
+    NgramSketch()
+      : _bits(size_bytes)
     {}
 
-    size_t operator()(span<char_t> data)
+    /// Add the 4-grams ending in data
+    void add(span<const uint8_t> data)
     {
-        const size_t sz = size_t(::details::round_down<cache_line_size>(data.end()) - data.begin());
-        if (unlikely(sz > this->size())) return 0;
+        for (uint8_t c : data) {
+            if (_length < ngram_size - 1) _head[_length] = c;
+            _last = (_last << 8) | c;
+            if (++_length >= ngram_size) {
+                const uint32_t h = hash(_last);
+                _bits[h >> 3] = uint8_t(_bits[h >> 3] | (1u << (h & 7)));
+            }
+        }
+    }
 
-        char_t* dst = this->begin();
-        this->pop_front(sz);
+    /// Add the 4-grams spanning the end of this text and the start of the next one (of at least 3 bytes)
+    void add_boundary(const NgramSketch& next)
+    {
+        add({next._head, std::min(next._length, size_t(ngram_size - 1))});
+    }
 
-        details::stream_memcpy(dst, data.begin(), sz * sizeof(char_t));
-        return sz;
+    const std::vector<uint8_t>& bits() const { return _bits; }
+
+    /// Whether pattern may be in a text of sketch bits, or span it and the next text (if next_bits isn't empty)
+    static bool may_contain(span<const uint8_t> bits, span<const uint8_t> next_bits, span<const uint8_t> pattern)
+    {
+        if (bits.empty()) return true; // Not sketched
+        uint32_t gram = 0;
+        for (size_t i = 0; i < pattern.size(); i++) {
+            gram = (gram << 8) | pattern[i];
+            if (i + 1 < ngram_size) continue;
+            const uint32_t h = hash(gram);
+            if (!test(bits, h) && (next_bits.empty() || !test(next_bits, h))) return false;
+        }
+        return true;
     }
 
-    /// Copy the remaining data at the end of decompression, returns the remaining buffer space aligned to the next
-    /// cache line
-    span<char_t> final_flush(Window<char_t>& window)
-    { // We're leaving together
-        span<char_t> last_flush = window.flushable();
-        size_t       sz         = last_flush.size();
-        if (unlikely(sz > this->size())) return {}; // Not enough space
+  private:
+    static uint32_t hash(uint32_t gram) { return (gram * 0x9E3779B1u) >> (32 - hash_bits); }
+    static bool     test(span<const uint8_t> bits, uint32_t h) { return (bits[h >> 3] >> (h & 7)) & 1; }
 
-        memcpy(this->begin(), last_flush.begin(), sz * sizeof(char_t));
-        this->pop_front(sz);
+    std::vector<uint8_t> _bits;
+    uint8_t              _head[ngram_size - 1] = {};
+    uint32_t             _last                 = 0;
+    size_t               _length               = 0;
+};
 
-        return {::details::round_up<cache_line_size>(this->begin()), this->end()};
-    }
+constexpr unsigned NgramSketch::ngram_size;
+constexpr size_t   NgramSketch::size_bytes;
 
-    // Return a pointer after the last written symbol in the buffer
-    char_t* buf_ptr() const { return this->begin(); }
+/// Order-insensitive aggregate a consumer can get instead of the content of the random access chunks
+enum class aggregate
+{
+    none,       // The content
+    line_feeds, // The occurrences of '\n'
+    bytes       // The occurrences of each byte
 };
 
+/// Occurrences of each byte in a part of the output
+using byte_counts_t = std::array<size_t, 256>;
+
 // Virtual base class for pugz consumers
 class ConsumerInterface
 {
@@ -761,32 +1349,77 @@ class ConsumerInterface
         _chunk_idx  = chunk_idx;
         _last_chunk = is_last;
     }
-    void set_section_idx(unsigned section_idx) { _section_idx = section_idx; }
 
     unsigned chunk_idx() const { return _chunk_idx; }
-    unsigned section_idx() const { return _section_idx; }
     bool     is_last_chunk() const { return _last_chunk; }
 
+    /// Time spent by the current chunk waiting for other chunks
+    WaitClock& wait_clock() { return _wait_clock; }
+
+    /// Return the number of bytes output since the last call
+    size_t take_output_size()
+    {
+        size_t output_size = _output_size;
+        _output_size       = 0;
+        return output_size;
+    }
+
+    /// Also count the lines of the output (see take_output_lines())
+    void count_lines(bool enable) { _count_lines = enable; }
+
+    /// Also add the output to a sketch (nullptr for none)
+    void set_sketch(NgramSketch* sketch) { _sketch = sketch; }
+
+    /// Return the number of line feeds output since the last call, if count_lines() is enabled
+    size_t take_output_lines()
+    {
+        size_t output_lines = _output_lines;
+        _output_lines       = 0;
+        return output_lines;
+    }
+
     size_t operator()(span<const uint8_t> data)
     {
         flush(data, false);
         return data.size();
     }
 
+    /// Whether the chunk can be output without waiting for the previous ones
+    virtual bool output_ready() = 0;
+
     // Flushes the already resolved context in ~32KB step, last indicates if this is the last of the chunk
     virtual void flush(span<const uint8_t> data, bool last) = 0;
-    virtual void flush(span<uint16_t>      data16bits,
-                       span<const uint8_t> lkt16bits,
-                       span<uint8_t>       data8bits,
-                       span<const uint8_t> lkt8bits)
-      = 0;
+
+    /// What the consumer needs from the random access chunks, see flush_counts()
+    virtual aggregate aggregate_only() const { return aggregate::none; }
+    /// Instead of flush() when aggregate_only() is not none: the size and the byte counts of content that is never
+    /// translated (only counts['\n'] is complete for aggregate::line_feeds)
+    virtual void flush_counts(size_t, const byte_counts_t&, bool) { assert(false); }
 
     virtual ~ConsumerInterface() {}
 
+  protected:
+    void add_output_size(size_t n) { _output_size += n; }
+    void add_output_content(span<const uint8_t> data)
+    {
+        if (unlikely(_count_lines)) _output_lines += count_newlines(data);
+        if (unlikely(_sketch != nullptr)) _sketch->add(data);
+    }
+    void add_output_lines(size_t lines)
+    {
+        assert(_sketch == nullptr);
+        if (unlikely(_count_lines)) _output_lines += lines;
+    }
+    bool sketching() const { return _sketch != nullptr; }
+
   private:
-    unsigned _chunk_idx   = 0;
-    unsigned _section_idx = 0;
-    bool     _last_chunk  = false;
+    unsigned     _chunk_idx    = 0;
+    bool         _last_chunk   = false;
+    WaitClock    _wait_clock   = {};
+    size_t       _output_size  = 0;
+    bool         _count_lines  = false;
+    size_t       _output_lines = 0;
+    NgramSketch* _sketch       = nullptr;
 };
 
 /** Compresses the 16bits back-references symbols into 8bits using a lookup-table
@@ -801,17 +1434,22 @@ template<typename NarrowWindow = Window<uint8_t>, typename WideWindow = Window<u
     static constexpr narrow_t last_backref_symbol     = std::numeric_limits<narrow_t>::max();
     static constexpr unsigned total_available_symbols = unsigned(last_backref_symbol) + 1;
     static constexpr size_t   context_size            = WideWindow::context_size;
+    static constexpr size_t   block_size              = 32; // Characters checked at once for back-references
 
     static_assert(WideWindow::context_size == context_size, "Both window should have the same context size");
+    static_assert(context_size % block_size == 0, "The context should be made of whole blocks");
 
     BackrefMultiplexer()
       : lkt8to16bits(make_unique_span<wide_t>(total_available_symbols))
       , lkt16bits2chr(make_unique_span<narrow_t>(first_backref_symbol + context_size))
       , lkt8bits2chr(make_unique_span<narrow_t>(total_available_symbols))
+      , offset2symbol(make_unique_span<narrow_t>(context_size))
+      , offset_generation(make_unique_span<unsigned>(context_size))
     {
         for (narrow_t i = 0; i < first_backref_symbol; i++) {
             lkt8to16bits[i] = 0;
         }
+        std::fill(offset_generation.begin(), offset_generation.end(), 0u);
         // Prepare the linear part of lookup table
         for (unsigned i = 0; i < first_backref_symbol; i++) {
             lkt16bits2chr[i] = narrow_t(i);
@@ -826,36 +1464,47 @@ template<typename NarrowWindow = Window<uint8_t>, typename WideWindow = Window<u
     {
         assert(lkt8to16bits);
 
+        // Forget the symbols allocated by the previous call, without clearing offset2symbol
+        if (unlikely(++generation == 0)) {
+            std::fill(offset_generation.begin(), offset_generation.end(), 0u);
+            generation = 1;
+        }
         narrow_t next_symbol = first_backref_symbol;
 
-        narrow_t* output_p = output_context.current_context().begin();
-        for (wide_t c_from : input_context.current_context()) {
-            narrow_t c_to;
-            if (c_from < first_backref_symbol) {
-                c_to = narrow_t(c_from);                        // An in range (resolved) character
-            } else {                                            // Or a backref indexing the initial (unknown) context
-                c_from = wide_t(c_from - first_backref_symbol); // Get the back-ref offset
-                // Linear scan looking for an already allocated backref symbol
-                c_to = narrow_t(0);
-                for (unsigned i = first_backref_symbol; i < next_symbol; i++) {
-                    if (lkt8to16bits[i] == c_from) {
-                        c_to = narrow_t(i);
-                        assert(c_to != narrow_t(0));
-                        break;
-                    }
+        const wide_t* input_p  = input_context.current_context().begin();
+        narrow_t*     output_p = output_context.current_context().begin();
+        for (; input_p != input_context.current_context().end(); input_p += block_size, output_p += block_size) {
+            // Most blocks are only made of resolved characters: narrow them at once (vectorized by the compiler)
+            wide_t block_max = 0;
+            for (size_t i = 0; i < block_size; i++)
+                block_max = std::max(block_max, input_p[i]);
+            if (block_max < first_backref_symbol) {
+                for (size_t i = 0; i < block_size; i++)
+                    output_p[i] = narrow_t(input_p[i]);
+                continue;
+            }
+
+            for (size_t i = 0; i < block_size; i++) {
+                wide_t c_from = input_p[i];
+                if (c_from < first_backref_symbol) { // An in range (resolved) character
+                    output_p[i] = narrow_t(c_from);
+                    continue;
                 }
-                if (c_to == narrow_t(0)) { // Not found
-                    // Try to allocate a new symbol
-                    if (next_symbol == 0) { // wrapped arround at previous allocation
+                // Or a backref indexing the initial (unknown) context
+                c_from = wide_t(c_from - first_backref_symbol); // Get the back-ref offset
+                assert(c_from < context_size);
+                if (offset_generation[c_from] != generation) { // No symbol allocated yet for this offset
+                    if (next_symbol == 0) {                    // wrapped arround at previous allocation
                         is_compressed = false;
                         return false;
                     }
-                    c_to                        = narrow_t(next_symbol);
+                    offset_generation[c_from]   = generation;
+                    offset2symbol[c_from]       = next_symbol;
                     lkt8to16bits[next_symbol++] = c_from;
                 }
-                assert(c_to >= first_backref_symbol);
+                output_p[i] = offset2symbol[c_from];
+                assert(output_p[i] >= first_backref_symbol);
             }
-            *output_p++ = c_to;
         }
         assert(output_p == output_context.current_context().end());
 
@@ -872,6 +1521,7 @@ template<typename NarrowWindow = Window<uint8_t>, typename WideWindow = Window<u
         }
         assert(pcomp == output_context.current_context().end());
 #endif
+        used_symbols  = next_symbol == 0 ? total_available_symbols : next_symbol;
         is_compressed = true;
         return true;
     }
@@ -890,7 +1540,8 @@ template<typename NarrowWindow = Window<uint8_t>, typename WideWindow = Window<u
 
         if (is_compressed) {
             // Compose the compression lookup table to get the tranlation lookup table for 8bit compressed symbols
-            for (unsigned i = first_backref_symbol; i < total_available_symbols; i++) {
+            // Only the allocated symbols: the others hold stale (or uninitialized) offsets
+            for (unsigned i = first_backref_symbol; i < used_symbols; i++) {
                 wide_t offset = lkt8to16bits[i];
                 assert(offset < NarrowWindow::context_size);
                 narrow_t chr = context[offset];
@@ -904,6 +1555,12 @@ template<typename NarrowWindow = Window<uint8_t>, typename WideWindow = Window<u
     unique_span<narrow_t> lkt16bits2chr; // 16bits code -> 8bit char = [\0, '~'] + context
     unique_span<narrow_t> lkt8bits2chr;  // 8bits code -> 8bit char = [\0, '~'] + context[lkt8to16bits]
     bool                  is_compressed = false;
+    unsigned              used_symbols  = first_backref_symbol; // Symbols allocated by compress_backref_symbols
+
+  private:
+    unique_span<narrow_t> offset2symbol;     // offset 16bit -> 8bits code, reverse of lkt8to16bits
+    unique_span<unsigned> offset_generation; // Call of compress_backref_symbols that set offset2symbol[offset]
+    unsigned              generation = 0;
 };
 
 class gzip_error : public std::runtime_error
@@ -915,48 +1572,286 @@ class gzip_error : public std::runtime_error
     {}
 };
 
-/// Monomorphic base for passing information accross threads
-class DeflateThread : public DeflateParser
+/** Hand-off point between two consecutive chunks of the compressed stream
+ * The upstream chunk decodes until the stop position (refined by the downstream chunk once it has found its first
+ * block), then posts a copy of the context it ended with. The chain of contexts is thus tracked per chunk, regardless
+ * of which thread happens to decode each side.
+ *
+ * Before its own context is known, a chunk posts the context it ends with as a function of the context it started
+ * with: 16bits symbols, either characters or back-references to the previous boundary (see set_symbolic_context()).
+ * Waiting for a context composes these functions with the ones upstream, so that each step doubles the number of
+ * chunks spanned (pointer jumping): once the chunks of a run have posted theirs, the context of the first chunk reaches
+ * the last one in a logarithmic number of compositions, instead of a chain of resolved chunks. A function only holds if
+ * the chunk before its base stopped where the chunk after started, else the context comes from the upstream chunk once
+ * it decoded again from the right position.
+ */
+class ChunkBoundary
 {
   public:
     static constexpr size_t unset_stop_pos = ~0UL;
+    using context_t                        = Window<uint8_t>;
+    /// Symbols of symbolic contexts: characters below, back-references to the context of their base from there
+    static constexpr unsigned first_backref_symbol = context_t::max_value + 1;
 
-    DeflateThread(const InputStream& input_stream, ConsumerInterface& consumer)
-      : DeflateParser(input_stream)
-      , _consumer(consumer)
+    explicit ChunkBoundary(size_t stop_bitpos = unset_stop_pos)
+      : _stop_after(stop_bitpos)
     {}
 
-    // Return the context and the position of the next block in the stream
-    std::pair<locked_span<uint8_t>, size_t> get_context()
+    ChunkBoundary(const ChunkBoundary&) = delete;
+    ChunkBoundary& operator=(const ChunkBoundary&) = delete;
+
+    /// Set the position of the first synced block downstream, so that the upstream chunk stops before this block
+    void set_end_block(size_t synced_pos)
+    {
+        PRINT_DEBUG("%p set to stop after %lu\n", (void*)this, synced_pos);
+        _stop_after.store(synced_pos, std::memory_order_release);
+    }
+
+    size_t get_stop_pos() const { return _stop_after.load(std::memory_order_acquire); }
+
+    /// Post the context of the upstream chunk and the position where it stopped
+    void set_context(span<const uint8_t> ctx, size_t stopped_at)
+    {
+#ifndef NDEBUG
+        for (uint8_t c : ctx) {
+            assert(c >= context_t::min_value && c <= context_t::max_value);
+        }
+#endif
+        assert(ctx.size() == context_t::context_size);
+        auto           context = std::make_shared<const chars_t>(ctx.begin(), ctx.end());
+        ChunkBoundary* base    = nullptr;
+        {
+            auto lock = std::unique_lock<std::mutex>(_mut);
+            if (_state == state_t::READY) { // Already composed from the symbolic context
+                assert(!_context || (*_context == *context && _stoped_at == stopped_at));
+                return;
+            }
+            assert(_state == state_t::PENDING || _state == state_t::SYMBOLIC);
+            if (_symbolic) base = _symbolic->base;
+            resolved(std::move(context), stopped_at);
+        }
+        if (base != nullptr) base->notify_dependents();
+    }
+
+    /** Post the context of the upstream chunk as a function of the context posted to base (its own upstream boundary),
+     * while the latter is unknown: the symbols are characters, or first_backref_symbol + an offset in the context of
+     * base. started_at is the first block of the upstream chunk, stopped_at where it stopped.
+     */
+    void set_symbolic_context(span<const uint16_t> symbols, ChunkBoundary* base, size_t started_at, size_t stopped_at)
     {
+        assert(symbols.size() == context_t::context_size && base != nullptr);
+        auto symbolic = std::make_shared<const symbolic_t>(
+          symbolic_t{std::vector<uint16_t>(symbols.begin(), symbols.end()), base, started_at});
+
         auto lock = std::unique_lock<std::mutex>(_mut);
-        while (_state == state_t::RUNNING)
-            _cond.wait(lock);
+        if (_state != state_t::PENDING) return; // Failed
+        _symbolic  = std::move(symbolic);
+        _stoped_at = stopped_at;
+        _state     = state_t::SYMBOLIC;
+        _cond.notify_all();
+        PRINT_DEBUG("%p symbolic context set at %lu\n", (void*)this, stopped_at);
+    }
 
-        if (_state == state_t::BORROWED_CONTEXT) {
-            span<uint8_t> context;
-            std::swap(context, _context);
-            // Signal that the context is used: the thread will be resumed once we release the lock
-            _state = state_t::RUNNING;
+    /// Signal that the upstream chunk failed: the context will never be available
+    void fail()
+    {
+        ChunkBoundary* base = nullptr;
+        {
+            auto lock = std::unique_lock<std::mutex>(_mut);
+            if (_state == state_t::READY || _state == state_t::FAIL) return;
+            PRINT_DEBUG("%p failed\n", (void*)this);
+            if (_symbolic) base = _symbolic->base;
+            _symbolic.reset();
+            _state = state_t::FAIL;
             _cond.notify_all();
-            PRINT_DEBUG("%p give context for block %lu\n", (void*)this, _stoped_at);
-            return {locked_span<uint8_t>{context, std::move(lock)}, _stoped_at};
-        } else {
-            assert(_state == state_t::FAIL);
-            return {locked_span<uint8_t>{}, unset_stop_pos};
         }
+        if (base != nullptr) base->notify_dependents();
     }
 
-    /// Set the position of the first synced block upstream, so that this thread stops before this block */
-    void set_end_block(size_t synced_pos)
+    /// Whether get_context() would return without waiting (after a composition step, see advance())
+    bool context_ready()
     {
-        PRINT_DEBUG("%p set to stop after %lu\n", (void*)this, synced_pos);
-        _stop_after.store(synced_pos, std::memory_order_release);
+        advance();
+        auto lock = std::unique_lock<std::mutex>(_mut);
+        return _state == state_t::READY || _state == state_t::FAIL;
+    }
+
+    /// Wait for the upstream context, composing the symbolic contexts upstream meanwhile. Returns it along with the
+    /// position of the next block in the stream (or unset_stop_pos if the upstream chunk failed)
+    std::pair<unique_span<uint8_t>, size_t> get_context()
+    {
+        for (;;) {
+            while (advance()) {}
+
+            std::shared_ptr<const symbolic_t> symbolic;
+            {
+                auto lock = std::unique_lock<std::mutex>(_mut);
+                if (_state == state_t::READY) {
+                    assert(_context);
+                    auto context = make_unique_span<uint8_t>(context_t::context_size);
+                    memcpy(context.begin(), _context->data(), context_t::context_size);
+                    return {std::move(context), _stoped_at};
+                }
+                if (_state == state_t::FAIL) return {unique_span<uint8_t>{}, unset_stop_pos};
+                if (_state == state_t::PENDING) {
+                    _cond.wait(lock);
+                    continue;
+                }
+                symbolic = _symbolic;
+            }
+            symbolic->base->wait_pending(*this, symbolic); // The base has nothing to compose with yet
+        }
+    }
+
+    /// Forget the context once the downstream chunk is done: symbolic contexts still based on it resolve from their
+    /// upstream chunk instead
+    void release()
+    {
+        auto lock = std::unique_lock<std::mutex>(_mut);
+        _context.reset();
+        _symbolic.reset();
+    }
+
+    /// Keep a copy of the context once posted, for indexing (see kept_context())
+    void keep_context() { _keep = true; }
+
+    /// The context posted by the upstream chunk if keep_context() was called (empty otherwise), once it was taken
+    span<const uint8_t> kept_context() const { return {_kept.begin(), _kept.end()}; }
+
+    /// Where the upstream chunk stopped, once its context was taken
+    size_t stopped_at() const { return _stoped_at; }
+
+  private:
+    using chars_t = std::vector<uint8_t>;
+
+    /// Context as a function of the context of base
+    struct symbolic_t
+    {
+        std::vector<uint16_t> symbols;
+        ChunkBoundary*        base;
+        size_t                base_stop; // Where the chunk before base must have stopped for the function to hold
+    };
+
+    enum class state_t { PENDING, SYMBOLIC, READY, FAIL };
+
+    /// The context is known (with the lock)
+    void resolved(std::shared_ptr<const chars_t> context, size_t stopped_at)
+    {
+        if (_keep) {
+            _kept = make_unique_span<uint8_t>(context_t::context_size);
+            memcpy(_kept.begin(), context->data(), context_t::context_size);
+        }
+        _context   = std::move(context);
+        _symbolic  = nullptr;
+        _stoped_at = stopped_at;
+        _state     = state_t::READY;
+        _cond.notify_all();
+        PRINT_DEBUG("%p context set at %lu\n", (void*)this, stopped_at);
+    }
+
+    /** Composes the symbolic context with the context of its base: characters resolve it, symbols make it a function of
+     * the base of the base. Returns false if there was nothing to do, or if the base has nothing to compose with yet.
+     * The function is dropped if it doesn't hold, or if the base was released: the upstream chunk will post the
+     * context.
+     */
+    bool advance()
+    {
+        std::shared_ptr<const symbolic_t> symbolic;
+        {
+            auto lock = std::unique_lock<std::mutex>(_mut);
+            if (_state != state_t::SYMBOLIC) return false;
+            symbolic = _symbolic;
+        }
+
+        std::shared_ptr<const symbolic_t> base_symbolic;
+        std::shared_ptr<const chars_t>    base_context;
+        bool                              holds;
+        {
+            ChunkBoundary& base = *symbolic->base;
+            auto           lock = std::unique_lock<std::mutex>(base._mut);
+            if (base._state == state_t::PENDING) return false;
+            holds         = base._stoped_at == symbolic->base_stop;
+            base_symbolic = base._symbolic;
+            base_context  = base._context;
+        }
+
+        constexpr unsigned   passthrough = first_backref_symbol;
+        span<const uint16_t> symbols     = {symbolic->symbols.data(), symbolic->symbols.size()};
+        if (holds && base_context) {
+            auto context = std::make_shared<chars_t>(context_t::context_size);
+            translate::compose<uint8_t>(symbols, base_context->data(), context->data(), passthrough);
+            auto lock = std::unique_lock<std::mutex>(_mut);
+            if (_symbolic == symbolic) resolved(std::move(context), _stoped_at);
+        } else if (holds && base_symbolic) {
+            auto composed = std::make_shared<symbolic_t>(symbolic_t{
+              std::vector<uint16_t>(context_t::context_size), base_symbolic->base, base_symbolic->base_stop});
+            translate::compose<uint16_t>(symbols, base_symbolic->symbols.data(), composed->symbols.data(), passthrough);
+            auto lock = std::unique_lock<std::mutex>(_mut);
+            if (_symbolic == symbolic) _symbolic = std::move(composed);
+        } else { // Doesn't hold, failed or released
+            auto lock = std::unique_lock<std::mutex>(_mut);
+            if (_symbolic == symbolic) {
+                PRINT_DEBUG("%p symbolic context dropped\n", (void*)this);
+                _symbolic = nullptr;
+                _state    = state_t::PENDING;
+            }
+        }
+        return true;
     }
 
-    void set_initial_context(span<uint8_t> context = {})
+    /// Wait while the base of the symbolic context of dependent (snapshot) has nothing to compose with
+    void wait_pending(ChunkBoundary& dependent, const std::shared_ptr<const symbolic_t>& snapshot)
+    {
+        // Locks upstream before downstream, changes of dependent notify this boundary after unlocking it
+        auto lock = std::unique_lock<std::mutex>(_mut);
+        while (_state == state_t::PENDING && dependent.has_symbolic(snapshot))
+            _cond.wait(lock);
+    }
+
+    bool has_symbolic(const std::shared_ptr<const symbolic_t>& snapshot)
+    {
+        auto lock = std::unique_lock<std::mutex>(_mut);
+        return _state == state_t::SYMBOLIC && _symbolic == snapshot;
+    }
+
+    void notify_dependents()
+    {
+        auto lock = std::unique_lock<std::mutex>(_mut);
+        _cond.notify_all();
+    }
+
+    std::mutex                        _mut{};
+    std::condition_variable           _cond{}; // Changes of this boundary, and of the boundaries waiting on it
+    std::atomic<size_t>               _stop_after;                // Where the upstream chunk should stop
+    size_t                            _stoped_at = unset_stop_pos; // Where it stopped
+    std::shared_ptr<const chars_t>    _context   = {};             // Shared with the boundaries composing with it
+    std::shared_ptr<const symbolic_t> _symbolic  = {};
+    unique_span<uint8_t>              _kept      = {};
+    bool                              _keep      = false;
+    state_t                           _state     = state_t::PENDING;
+};
+
+constexpr size_t ChunkBoundary::unset_stop_pos;
+
+/// Monomorphic base for decoding a chunk with a known (resolved) initial context
+class DeflateThread : public DeflateParser
+{
+  public:
+    static constexpr size_t unset_stop_pos = ChunkBoundary::unset_stop_pos;
+
+    DeflateThread(const InputStream& input_stream, ConsumerInterface& consumer)
+      : DeflateParser(input_stream)
+      , _consumer(consumer)
+    {}
+
+    DeflateThread(const DeflateThread&) = delete;
+    DeflateThread& operator=(const DeflateThread&) = delete;
+
+    /// Set the boundary where the current chunk stops and leaves its context
+    void set_downstream(ChunkBoundary* down_stream) { _down_stream = down_stream; }
+
+    void set_initial_context(span<const uint8_t> context = {})
     {
-        wait_for_context_borrow();
         _window.clear();
         if (context) { memcpy(_window.current_context().begin(), context.begin(), _window.current_context().size()); }
     }
@@ -964,8 +1859,7 @@ class DeflateThread : public DeflateParser
     // Decompress classically (typically used at position 0) until a certain position
     void go(size_t position_bits = 0)
     {
-        wait_for_context_borrow();
-
+        assert(_down_stream != nullptr);
         _in_stream.set_position_bits(position_bits);
 
         _window.clear();
@@ -977,51 +1871,17 @@ class DeflateThread : public DeflateParser
         _consumer.flush(_window.flushable(), true);
     }
 
-    ~DeflateThread()
-    {
-        wait_for_context_borrow(); // Someone might be reading from our windows, so wait before freeing it.
-        PRINT_DEBUG("~DeflateThread()");
-    }
-
   protected:
-    void wait_for_context_borrow()
-    {
-        auto lock         = std::unique_lock<std::mutex>(_mut);
-        bool was_borrowed = _state == state_t::BORROWED_CONTEXT;
-        while (_state == state_t::BORROWED_CONTEXT)
-            _cond.wait(lock);
-
-        if (was_borrowed) PRINT_DEBUG("%p get context borrow back\n", (void*)this);
-    }
-
-    // Post context and wait for it to be consumed
+    // Post a copy of the context for the downstream chunk (the last chunk has none, and might not even fill a context)
     void set_context(span<uint8_t> ctx)
     {
-#ifndef NDEBUG
-        PRINT_DEBUG("%p set context\n", (void*)this);
-        for (uint8_t c : ctx) {
-            assert(c >= Window<uint8_t>::min_value && c <= Window<uint8_t>::max_value);
-        }
-#endif
-
-        auto lock  = std::unique_lock<std::mutex>(_mut);
-        _context   = ctx;
-        _stoped_at = _in_stream.position_bits();
-        assert(_state == state_t::RUNNING);
-        _state = state_t::BORROWED_CONTEXT;
-        _cond.notify_all();
+        if (!_consumer.is_last_chunk()) _down_stream->set_context(ctx, _in_stream.position_bits());
     }
 
-    // Enter failed state
+    // Downstream chunk will not get a context
     void fail()
     {
-        PRINT_DEBUG("%p failed\n", (void*)this);
-        auto lock = std::unique_lock<std::mutex>(_mut);
-        while (_state == state_t::BORROWED_CONTEXT)
-            _cond.wait(lock);
-
-        _state = state_t::FAIL;
-        _cond.notify_all();
+        if (_down_stream != nullptr) _down_stream->fail();
     }
 
     template<typename T> void throw_gzip_error(T msg)
@@ -1030,7 +1890,7 @@ class DeflateThread : public DeflateParser
         throw gzip_error(msg);
     }
 
-    size_t get_stop_pos() const { return _stop_after.load(std::memory_order_acquire); }
+    size_t get_stop_pos() const { return _down_stream->get_stop_pos(); }
 
     template<typename Window, typename Sink, typename Predicate>
     flatten_fun block_result decompress_loop(Window& window, Sink& sink, Predicate&& predicate)
@@ -1047,7 +1907,6 @@ class DeflateThread : public DeflateParser
                 } else {
                     PRINT_DEBUG("%p stoped at %lu\n", (void*)this, _in_stream.position_bits());
                 }
-                _stop_after.store(unset_stop_pos, std::memory_order_relaxed);
                 return block_result::CAUGHT_UP_DOWNSTREAM;
             }
             block_result res = do_block(window, sink, ShouldSucceed{});
@@ -1058,25 +1917,24 @@ class DeflateThread : public DeflateParser
   protected:
     Window<uint8_t>    _window = {};
     ConsumerInterface& _consumer;
-
-  private:
-    /* Members for synchronization and communication */
-    std::mutex              _mut{};
-    std::condition_variable _cond{};
-    std::atomic<size_t>     _stop_after = {unset_stop_pos}; // Where we should stop
-    size_t                  _stoped_at  = unset_stop_pos;   // Where we stopped
-    span<uint8_t>           _context    = {};
-    enum class state_t { RUNNING, BORROWED_CONTEXT, FAIL };
-    state_t _state = state_t::RUNNING;
+    ChunkBoundary*     _down_stream = nullptr;
 };
 
 constexpr size_t DeflateThread::unset_stop_pos;
 
+#ifndef PUGZ_RANDOM_ACCESS_BUFFER_SIZE
+// Size of the symbol buffer of the random access chunks (the tests shrink it to make chunks spill)
+#    define PUGZ_RANDOM_ACCESS_BUFFER_SIZE (512ull << 20)
+#endif
+
 class DeflateThreadRandomAccess : public DeflateThread
 {
 
   public:
-    static constexpr size_t buffer_virtual_size = 512ull << 20;
+    static constexpr size_t buffer_virtual_size = PUGZ_RANDOM_ACCESS_BUFFER_SIZE;
+    /// Symbols kept free in the buffers to finish any block (a zlib block is at most 32K symbols, ~8MiB). When less
+    /// remain, the rest of the chunk is decoded with the resolved context after the buffered part (see flush())
+    static constexpr size_t spill_margin = 16ull << 20;
 
     DeflateThreadRandomAccess(const InputStream& input_stream, ConsumerInterface& consumer)
       : DeflateThread(input_stream, consumer)
@@ -1086,72 +1944,259 @@ class DeflateThreadRandomAccess : public DeflateThread
     DeflateThreadRandomAccess(const DeflateThreadRandomAccess&) = delete;
     DeflateThreadRandomAccess& operator=(const DeflateThreadRandomAccess&) = delete;
 
-    ~DeflateThreadRandomAccess()
+    /// Set the boundary where the previous chunk leaves the context of the current chunk
+    void set_upstream(ChunkBoundary* up_stream) { _up_stream = up_stream; }
+
+    /// Finds the first block of the chunk after skip, and sets the stop position of the previous chunk right before it
+    size_t sync(size_t skip)
     {
-        wait_for_context_borrow();
-        PRINT_DEBUG("~DeflateThreadRandomAccess\n");
+        // The trial decodes build a table per candidate, which the smallest geometry fills fastest
+        const unsigned tablebits = litlen_tablebits();
+        set_litlen_tablebits(LITLEN_MIN_TABLEBITS);
+        const size_t pos = find_block(skip);
+        set_litlen_tablebits(tablebits);
+        if (pos < 8 * _in_stream.size()) _up_stream->set_end_block(pos);
+        return pos;
     }
 
-    void set_upstream(DeflateThread* up_stream) { _up_stream = up_stream; }
-
-    // Finds a new block of decompressed size >= min_block_size bits
-    // between positions [skip, skip+max_bits_skip] in the compressed stream
-    size_t sync(size_t       skip,
-                const size_t max_bits_skip  = size_t(1) << (3 + 20), // 1MiB
-                const size_t min_block_size = 1 << 13                // 8KiB
-    )
+    // Decompress a chunk starting at position "skipbits" (in bits) in the compressed stream
+    // will guess (by calling sync()) the position of the next block
+    bool go(size_t skipbits)
     {
-        _in_stream.set_position_bits(skip);
+        decode(skipbits, []() {});
+        if (!resolve_context()) return false;
+        flush();
+        return true;
+    }
 
-        DummyWindow dummy_win;
+    /** First pass over a chunk: syncs after "skipbits" and decodes until the stop position into the 16bits (then 8bits)
+     * symbol buffers. Never waits for other chunks: between_blocks() is called after each block, so that the caller can
+     * make progress on another chunk in flight.
+     * The first block can be given if it was synced ahead of time (and the upstream stop position set accordingly).
+     */
+    template<typename Hook>
+    void decode(size_t skipbits, Hook&& between_blocks, size_t synced_bitpos = unset_stop_pos)
+    {
+        assert(_up_stream != nullptr);
+        _known_context = false;
 
-        size_t       pos     = skip;
-        const size_t max_pos = pos + std::min(8 * _in_stream.size(), max_bits_skip);
+        for (size_t skip = skipbits;; skip = _sync_bitpos + 1) {
+            if (synced_bitpos != unset_stop_pos) {
+                _sync_bitpos = synced_bitpos;
+                _in_stream.set_position_bits(synced_bitpos);
+                synced_bitpos = unset_stop_pos;
+            } else {
+                _sync_bitpos = sync(skip);
+            }
 
-        for (_in_stream.ensure_bits<1>(); pos < max_pos; pos++) {
-            assert(pos == _in_stream.position_bits());
+            // Get the bit position where the chunk stops: the coarse chunk end set by the scheduler, until the next
+            // chunk refines it with its own synced position.
+            // FIXME: this could be combined with the previous check and checked in sync()
+            size_t stop_bitpos = get_stop_pos();
+            if (stop_bitpos != unset_stop_pos && _sync_bitpos >= stop_bitpos) {
+                // FIXME: We found our first block after where we are supposed to stop; Could be due to the
+                // file being multi-part (hence not yet supported by pugz)
+                throw_gzip_error("Failed to find a gzip block during random access");
+            }
 
-            if (_in_stream.bits<uint8_t>(1)) { // We don't expect to find a final block
-                _in_stream.remove_bits(1);
-                _in_stream.ensure_bits<1>();
-                continue;
+            block_result res = first_pass(between_blocks);
+            if (likely(res <= block_result::FLUSH_FAIL)) {
+                post_symbolic_context();
+                count_symbols();
+                break;
             }
 
-            PRINT_DEBUG_DECODING("trying to decode huffman block at %lu\n", pos);
+            // Parse error: the synced block was a false positive, resume the search after it
+            PRINT_DEBUG("%p false positive block at %lu (%s), resyncing\n",
+                        (void*)this,
+                        _sync_bitpos,
+                        block_result_to_cstr(res));
+        }
+    }
 
-            block_result res = do_block(dummy_win, dummy_win, ShouldFail{});
+    /** First pass over a chunk whose initial context is known (from an index): decodes from the block at bitpos
+     * straight to 8bits symbols, so that resolve_context() doesn't wait and nothing is left to translate
+     */
+    template<typename Hook> void decode_with_context(size_t bitpos, span<const uint8_t> context, Hook&& between_blocks)
+    {
+        _sync_bitpos   = bitpos;
+        _known_context = true;
+        _wide_data     = {};
+        _narrowed      = true;
+        this->set_initial_context(context);
+        _in_stream.set_position_bits(bitpos);
+
+        span<uint8_t>       narrow_buffer = buffer.reinterpret<uint8_t>();
+        SinkBuffer<uint8_t> narrow_sink   = narrow_buffer;
+        _sequential_tail                  = false;
+        auto res                          = this->decompress_loop(_window, narrow_sink, [&]() {
+            between_blocks();
+            return _sequential_tail = narrow_sink.size() < spill_margin;
+        });
+        // Invalid index, or a block larger than spill_margin
+        if (res >= block_result::FLUSH_FAIL) throw_gzip_error(res);
 
-            if (unlikely(res == block_result::SUCCESS && dummy_win.size() >= min_block_size)) {
-                PRINT_DEBUG("%p Candidate block start at %lubits\n", (void*)this, pos);
-                _in_stream.set_position_bits(pos);
-                _up_stream->set_end_block(pos); // This is not even needed !
-                return pos;
+        narrow_sink.final_flush(_window);
+        _narrow_data = {narrow_buffer.begin(), narrow_sink.begin()};
+        count_symbols();
+    }
+
+    /// Whether the context of the previous chunk is available (resolve_context() would not block)
+    bool context_ready() const { return _known_context || _up_stream->context_ready(); }
+
+    /** Second pass, part 1: gets the context of the previous chunk, builds the translation tables, posts the
+     * translated context of the next chunk, then translates the chunk. Returns false if a previous chunk failed.
+     * Does not wait for the previous chunks to be output: the chunks are translated in parallel.
+     */
+    bool resolve_context()
+    {
+        if (_known_context) {
+            if (_sequential_tail) {
+                auto discard = [](span<uint8_t> data) { return data.size(); };
+                _window.flush(discard);
+            } else {
+                this->set_context(_window.current_context());
             }
+            return true;
+        }
 
-            dummy_win.clear();
-            if (unlikely(!_in_stream.set_position_bits(pos + 1))) { break; }
+        auto wait_start       = WaitClock::now();
+        auto upstream_context = _up_stream->get_context();
+        _consumer.wait_clock().stop(wait_start);
+        if (upstream_context.second == unset_stop_pos) {
+            // Upstream decompressor failed
+            fail();
+            return false;
+        }
+
+        // Check if the context position we got match with our start position
+        if (unlikely(upstream_context.second != _sync_bitpos)) {
+            // Our first block was a false positive, or the previous chunk stopped before it. Decode the chunk again
+            // from where the previous one stopped, with its context (in flush())
+            PRINT_DEBUG("%p got a context from %lu instead of %lu, decoding again\n",
+                        (void*)this,
+                        upstream_context.second,
+                        _sync_bitpos);
+            _wide_data       = {};
+            _narrow_data     = {};
+            _counts.fill(0);
+            _sequential_tail = true;
+            this->set_initial_context(upstream_context.first);
+            _in_stream.set_position_bits(upstream_context.second);
+            return true;
+        }
+        multiplexer.compose_context(upstream_context.first);
+
+        // Translate the context for the next block
+        constexpr unsigned passthrough = decltype(multiplexer)::first_backref_symbol;
+        if (_narrowed) {
+            translate::narrow(_window.current_context(), multiplexer.lkt8bits2chr, passthrough);
+        } else {
+            _window.clear();
+            translate::wide(
+              wide_window.current_context(), _window.current_context().begin(), multiplexer.lkt16bits2chr, passthrough);
+        }
+        assert(std::all_of(_window.current_context().begin(), _window.current_context().end(), [&](uint8_t c) {
+            return c >= _window.min_value && c <= _window.max_value;
+        }));
+
+        if (_sequential_tail) {
+            // The window continues from this context in flush(), its content is already in the buffers
+            auto discard = [](span<uint8_t> data) { return data.size(); };
+            _window.flush(discard);
+        } else {
+            this->set_context(_window.current_context());
         }
-        return 8 * _in_stream.size();
+
+        if (_aggregate != aggregate::none) {
+            // Rather than translating the chunk, compose its symbol counts with the translation tables
+            for (size_t sym = 0; sym < _wide_hist.size(); sym++)
+                _counts[multiplexer.lkt16bits2chr[sym]] += _wide_hist[sym];
+            if (_aggregate == aggregate::line_feeds) {
+                _counts['\n'] += translate::count(_narrow_data, multiplexer.lkt8bits2chr, '\n');
+            } else {
+                for (unsigned sym = 0; sym < _narrow_hist.size(); sym++)
+                    _counts[multiplexer.lkt8bits2chr[sym]] += _narrow_hist[sym];
+            }
+            return true;
+        }
+
+        // The 16bits symbols are narrowed to the start of their buffer, the 8bits symbols are translated in place
+        auto* wide_chars = reinterpret_cast<uint8_t*>(_wide_data.begin());
+        translate::wide(_wide_data, wide_chars, multiplexer.lkt16bits2chr, passthrough);
+        translate::narrow(_narrow_data, multiplexer.lkt8bits2chr, passthrough);
+        return true;
     }
 
-    // Decompress a chunk starting at position "skipbits" (in bits) in the compressed stream
-    // will guess (by calling sync()) the position of the next block
-    bool go(size_t skipbits)
+    /// Second pass, part 2: outputs the translated chunk (or its byte counts), in order
+    void flush()
     {
-        assert(_up_stream != nullptr);
+        const bool last = !_sequential_tail;
+        if (_aggregate != aggregate::none) {
+            _consumer.flush_counts(_wide_data.size() + _narrow_data.size(), _counts, last);
+        } else {
+            _consumer.flush({reinterpret_cast<const uint8_t*>(_wide_data.begin()), _wide_data.size()}, false);
+            _consumer.flush(_narrow_data, last);
+        }
+        if (likely(last)) return;
 
-        size_t sync_bitpos = sync(skipbits);
+        // Decode the rest of the chunk with the resolved context, straight to the consumer, while holding the output
+        // turn. The context for the next chunk is only available at the end.
+        auto res = this->decompress_loop(_window, _consumer, []() { return false; });
+        if (res > block_result::CAUGHT_UP_DOWNSTREAM) { throw_gzip_error(res); }
+
+        this->set_context(_window.current_context());
+        _consumer.flush(_window.flushable(), true);
+    }
 
-        // Get the bit position where the chunk stops. Previously it came from the thread handling the upstream chunk,
-        // now it is set up deterministically from go()'s caller.
-        // FIXME: With the new setup, this could be combined with the previous check and checked in sync()
-        size_t stop_bitpos = get_stop_pos();
-        if (stop_bitpos != unset_stop_pos && sync_bitpos >= stop_bitpos) {
-            // FIXME: We found our first block after where we are supposed to stop; Could be due to the
-            // file being multi-part (hence not yet supported by pugz)
-            throw_gzip_error("Failed to find a gzip block during random access");
+  private:
+    /// Posts the context the chunk ends with as a function of the context it starts with, for the next chunks to
+    /// compose with theirs (see ChunkBoundary)
+    void post_symbolic_context()
+    {
+        if (_sequential_tail || _consumer.is_last_chunk()) return; // The end of the chunk is decoded in flush()
+
+        constexpr unsigned passthrough = decltype(multiplexer)::first_backref_symbol;
+        static_assert(passthrough == ChunkBoundary::first_backref_symbol, "Both should encode back-references alike");
+        span<const uint16_t> symbols = wide_window.current_context();
+        if (_narrowed) { // Back to offsets in the initial context
+            std::vector<uint16_t> widened(_window.current_context().size());
+            for (size_t i = 0; i < widened.size(); i++) {
+                const uint8_t sym = _window.current_context()[i];
+                widened[i]        = sym < passthrough ? sym : uint16_t(passthrough + multiplexer.lkt8to16bits[sym]);
+            }
+            _down_stream->set_symbolic_context(
+              {widened.data(), widened.size()}, _up_stream, _sync_bitpos, _in_stream.position_bits());
+        } else {
+            _down_stream->set_symbolic_context(symbols, _up_stream, _sync_bitpos, _in_stream.position_bits());
         }
+    }
 
+    /** For consumers of aggregates, at the end of the first pass: counts how many times each symbol occurs, so that the
+     * second pass doesn't translate the chunk. For line feeds, histogramming the 16bits symbols is cheaper than
+     * narrowing them, while the 8bits symbols are counted through the lookup table once known (see translate::count()).
+     */
+    void count_symbols()
+    {
+        _aggregate = _consumer.aggregate_only();
+        if (_aggregate == aggregate::none) return;
+
+        _counts.fill(0);
+        _wide_hist.assign(_known_context ? 0 : multiplexer.lkt16bits2chr.size(), 0);
+        _narrow_hist.assign(_aggregate == aggregate::bytes ? multiplexer.lkt8bits2chr.size() : 0, 0);
+        translate::histogram(_wide_data, _wide_hist.data());
+        if (_aggregate == aggregate::bytes) translate::histogram(_narrow_data, _narrow_hist.data());
+
+        if (_known_context) { // Already characters
+            if (_aggregate == aggregate::line_feeds) _counts['\n'] = count_newlines(_narrow_data);
+            std::copy(_narrow_hist.begin(), _narrow_hist.end(), _counts.begin());
+            _narrow_hist.clear();
+        }
+    }
+
+    /// Decode from the synced position, returns the parse error if any
+    template<typename Hook> block_result first_pass(Hook& between_blocks)
+    {
         // Prepare the wide_window
         span<uint16_t>       wide_buffer = buffer.reinterpret<uint16_t>();
         SinkBuffer<uint16_t> wide_sink   = wide_buffer;
@@ -1163,106 +2208,73 @@ class DeflateThreadRandomAccess : public DeflateThread
         // Decompress to 16bits buffer until there is a small enough number of back-references
         multiplexer.is_compressed = false;
         size_t block_count        = 0;
+        _sequential_tail          = false;
         auto   res                = decompress_loop(wide_window, wide_sink, [&]() {
+            between_blocks();
+            if (unlikely(wide_sink.size() < spill_margin)) return _sequential_tail = true;
             block_count++;
             if (block_count <= 8 || block_count % 2 == 0) return false;
 
-            wait_for_context_borrow(); // the narrow_window is mutated from this point
             _window.clear();
             return multiplexer.compress_backref_symbols(wide_window, _window);
         });
 
-        // Seal the 16bit buffer, and get the remaining for the 8bit part
-        span<uint8_t> narrow_buffer = wide_sink.final_flush(wide_window).reinterpret<uint8_t>();
-        wide_buffer                 = {wide_buffer.begin(), wide_sink.begin()};
+        // Seal the 16bits buffer, and get the remaining for the 8bits part
+        _narrow_data = wide_sink.final_flush(wide_window).reinterpret<uint8_t>();
+        _wide_data   = {wide_buffer.begin(), wide_sink.begin()};
+        _narrowed    = res == block_result::SUCCESS && !_sequential_tail;
 
-        if (res == block_result::SUCCESS) {
-            // Decompress to the 8bit buffer
-            SinkBuffer<uint8_t> narrow_sink = narrow_buffer;
-            res                             = this->decompress_loop(_window, narrow_sink, []() { return false; });
+        if (_narrowed) {
+            // Decompress to the 8bits buffer
+            SinkBuffer<uint8_t> narrow_sink = _narrow_data;
+            res                             = this->decompress_loop(_window, narrow_sink, [&]() {
+                between_blocks();
+                return _sequential_tail = narrow_sink.size() < spill_margin;
+            });
 
-            if (res == block_result::CAUGHT_UP_DOWNSTREAM || res == block_result::LAST_BLOCK) {
+            if (res == block_result::CAUGHT_UP_DOWNSTREAM || res == block_result::LAST_BLOCK || _sequential_tail) {
                 // Seal the narrow buffer
                 narrow_sink.final_flush(_window);
-                narrow_buffer = {narrow_buffer.begin(), narrow_sink.begin()};
-
-                // Get the context and prepare lookup table
-                if (!prepare_lookup_table(sync_bitpos)) return false;
-
-                // Translate the context for the next block
-                for (auto& c : _window.current_context()) {
-                    c = multiplexer.lkt8bits2chr[c];
-                    assert(c >= _window.min_value && c <= _window.max_value);
-                }
-                this->set_context(_window.current_context()); // From now on, the window is borrowed
-
-                _consumer.flush(wide_buffer, multiplexer.lkt16bits2chr, narrow_buffer, multiplexer.lkt8bits2chr);
+                _narrow_data = {_narrow_data.begin(), narrow_sink.begin()};
             } else if (res == block_result::FLUSH_FAIL) {
-                throw_gzip_error(res);
-                // FIXME: buffer too small for input buffer_virtual_size = 512MiB for 32MiB of input => max compression
-                // ratio of 16x. The simplest way to handle that is stop everything and retry with smaller
-                // sections/chunks
-            } else {
-                throw_gzip_error(res);
-                // At this point we have narrowed down the back-reference count to 126 and decoded more than 8 block, so
+                throw_gzip_error(res); // A block larger than spill_margin
             }
-
-        } else if (res == block_result::CAUGHT_UP_DOWNSTREAM || res == block_result::LAST_BLOCK) {
-            wait_for_context_borrow(); // the narrow_window is mutated from this point
-            _window.clear();
-
-            // Get the context and prepare lookup table
-            if (!prepare_lookup_table(sync_bitpos)) return false;
-
-            // Translate the context for the next block
-            auto* p = wide_window.current_context().begin();
-            for (auto& c : _window.current_context()) {
-                c = multiplexer.lkt16bits2chr[*p++];
-                assert(c >= _window.min_value && c <= _window.max_value);
-            }
-            assert(p == wide_window.current_context().end());
-
-            this->set_context(_window.current_context()); // From now on, the window is borrowed
-
-            _consumer.flush(wide_buffer, multiplexer.lkt16bits2chr, {}, {});
+        } else if (res == block_result::CAUGHT_UP_DOWNSTREAM || res == block_result::LAST_BLOCK || _sequential_tail) {
+            _narrow_data = {};
         } else if (res == block_result::FLUSH_FAIL) {
-            throw_gzip_error(res); // FIXME: buffer overflow, see above
-        } else {
-            throw_gzip_error(res);
-            // FIXME: parse error in the first blocks (before compressing the backrefs to 8bits)
-            // Maybe the synchronisation is a false positive and we should retry at sync_bitpos + 1
+            throw_gzip_error(res); // A block larger than spill_margin
         }
 
         if (res == block_result::LAST_BLOCK) {
             PRINT_DEBUG("%p last block at %lu\n", (void*)this, _in_stream.position_bits());
         }
-        return true;
-    }
-
-  private:
-    bool prepare_lookup_table(size_t sync_bitpos)
-    {
-        auto upstream_context = _up_stream->get_context();
-        if (upstream_context.second == unset_stop_pos) {
-            // Upstream decompressor failed
-            fail();
-            return false;
-        }
-        // Check if the context position we got match with our start position
-        if (upstream_context.second != sync_bitpos) {
-            // FIXME: redecompress from this position (with resolved context this time)
-            throw_gzip_error("Got a context from invalid position");
+        if (_sequential_tail) {
+            PRINT_DEBUG("%p buffer full at %lu, spilling\n", (void*)this, _in_stream.position_bits());
         }
-        multiplexer.compose_context(upstream_context.first);
-        return true;
+        return res;
     }
 
     malloc_span<uint8_t>                                  buffer;
     Window<uint16_t>                                      wide_window = {};
     BackrefMultiplexer<Window<uint8_t>, Window<uint16_t>> multiplexer = {};
-    DeflateThread*                                        _up_stream  = nullptr;
+    ChunkBoundary*                                        _up_stream  = nullptr;
+
+    // State of the decoded chunk, between the two passes
+    size_t         _sync_bitpos     = 0;     // Position of the first block
+    bool           _narrowed        = false; // Whether the end of the chunk was decoded to 8bits symbols
+    bool           _sequential_tail = false; // Whether the end of the chunk is decoded with the resolved context
+    bool           _known_context   = false; // Whether the chunk was decoded with its context (decode_with_context())
+    span<uint16_t> _wide_data       = {};
+    span<uint8_t>  _narrow_data     = {};
+
+    // Aggregates without translation (see count_symbols())
+    aggregate             _aggregate   = aggregate::none;
+    byte_counts_t         _counts      = {}; // Byte counts of the buffers, once the context is known
+    std::vector<uint32_t> _wide_hist   = {}; // Occurrences of each symbol in the 16bits buffer
+    std::vector<uint32_t> _narrow_hist = {}; // Occurrences of each symbol in the 8bits buffer (for aggregate::bytes)
 };
 
+/// Orders the output of the chunks by their index in the stream
 class ConsumerSync
 {
   public:
@@ -1271,99 +2283,126 @@ class ConsumerSync
     void wait(ConsumerInterface& consumer)
     {
         lock_t lock{_mut};
-        while (_section_idx != consumer.section_idx() || _chunk_idx != consumer.chunk_idx())
+        while (_chunk_idx != consumer.chunk_idx() && !_aborted)
             _cond.wait(lock);
+        if (_aborted) throw gzip_error("Decompression aborted");
         lock.release();
     }
 
-    void notify(ConsumerInterface& consumer)
+    /// Whether wait() would return without waiting for other chunks
+    bool ready(ConsumerInterface& consumer)
     {
-        if (not consumer.is_last_chunk()) {
-            _chunk_idx++;
-        } else {
-            _chunk_idx = 0;
-            _section_idx++;
-        }
+        lock_t lock{_mut, std::try_to_lock}; // Held while a previous chunk is output
+        return lock.owns_lock() && _chunk_idx == consumer.chunk_idx();
+    }
+
+    void notify(ConsumerInterface&)
+    {
+        _chunk_idx++;
         _cond.notify_all();
         _mut.unlock();
     }
 
+    /// Wake up the chunks waiting for an output turn that will never come (a previous chunk failed)
+    void abort()
+    {
+        lock_t lock{_mut};
+        _aborted = true;
+        _cond.notify_all();
+    }
+
   private:
     std::mutex              _mut  = {};
     std::condition_variable _cond = {};
 
-    unsigned _section_idx = 0;
-    unsigned _chunk_idx   = 0;
+    unsigned _chunk_idx = 0;
+    bool     _aborted   = false;
 };
 
+/// Consumers declaring an aggregates constant (eg. LineCounter) get the byte counts of the random access chunks through
+/// add_counts(), in any order, rather than their translated content
+template<typename Consumer, typename = void>
+struct consumer_aggregate : std::integral_constant<aggregate, aggregate::none>
+{};
+template<typename Consumer>
+struct consumer_aggregate<Consumer, typename std::enable_if<Consumer::aggregates != aggregate::none>::type>
+  : std::integral_constant<aggregate, Consumer::aggregates>
+{};
+
 template<typename Consumer> class ConsumerWrapper : public ConsumerInterface
 {
   public:
     ConsumerWrapper(Consumer& consumer, ConsumerSync* sync = nullptr)
-      : _consumer(consumer)
+      : _consumer(&consumer)
       , _sync(sync)
     {}
 
     ConsumerWrapper(const ConsumerWrapper&) noexcept = default;
     ConsumerWrapper& operator=(const ConsumerWrapper&) noexcept = default;
 
+    /// Forward the next chunks to another consumer
+    void rebind(Consumer& consumer, ConsumerSync* sync = nullptr)
+    {
+        _consumer     = &consumer;
+        _sync         = sync;
+        _resolved_idx = 0; // Might be left by a failed chunk
+        wait_clock().take();
+        take_output_size();
+        take_output_lines();
+    }
+
+    virtual bool output_ready() { return _sync == nullptr || _sync->ready(*this); }
+
+    virtual aggregate aggregate_only() const
+    {
+        return sketching() ? aggregate::none : consumer_aggregate<Consumer>::value; // Sketches need the content
+    }
+
   protected:
     // Flushes the already resolved context in ~32KB step, last indicates if this is the last of the chunk
     virtual void flush(span<const uint8_t> data, bool last)
     {
-        if (not last) {
-            if (unlikely(_sync != nullptr && _resolved_idx == 0)) _sync->wait(*this);
+        // Only the hand-off to the consumer holds the output turn
+        add_output_size(data.size());
+        add_output_content(data);
+        hand_off(last, [&]() { (*_consumer)(data); });
+    }
 
-            _consumer(data);
+    virtual void flush_counts(size_t size, const byte_counts_t& counts, bool last)
+    {
+        add_output_size(size);
+        add_output_lines(counts['\n']);
+        hand_off(last, [&]() { add_counts(counts, has_aggregate{}); });
+    }
+
+  private:
+    /// Outputs in the turn of the chunk, which is kept until its last output
+    template<typename F> void hand_off(bool last, F output)
+    {
+        if (unlikely(_sync != nullptr && _resolved_idx == 0)) wait_turn();
 
+        output();
+
+        if (not last) {
             _resolved_idx++;
         } else {
-            _consumer(data);
-
             _resolved_idx = 0;
             if (_sync != nullptr) _sync->notify(*this);
         }
     }
 
-    virtual void flush(span<uint16_t>      data16bits,
-                       span<const uint8_t> lkt16bits,
-                       span<uint8_t>       data8bits,
-                       span<const uint8_t> lkt8bits)
-    {
-        if (_sync != nullptr) _sync->wait(*this);
-
-        slice_span(data16bits, 16 << 10, [&](span<uint16_t> slice) {
-            uint8_t* s = reinterpret_cast<uint8_t*>(slice.begin());
-            uint8_t* p = s;
-            for (auto sym : slice)
-                *p++ = lkt16bits[sym];
-            _consumer(span<const uint8_t>(s, p));
-        });
+    using has_aggregate = std::integral_constant<bool, consumer_aggregate<Consumer>::value != aggregate::none>;
+    void add_counts(const byte_counts_t& counts, std::true_type) { _consumer->add_counts(counts); }
+    void add_counts(const byte_counts_t&, std::false_type) { assert(false); }
 
-        slice_span(data8bits, 32 << 10, [&](span<uint8_t> slice) {
-            for (auto& sym : slice)
-                sym = lkt8bits[sym];
-            _consumer(span<const uint8_t>(slice));
-        });
-        if (_sync != nullptr) _sync->notify(*this);
-    }
-
-  private:
-    template<typename T, typename F> static void slice_span(span<T> data, size_t n, F f)
+    void wait_turn()
     {
-        T* start = data.begin();
-        T* end   = start + n;
-        for (;; start = end, end += n) {
-            if (end < data.end()) {
-                f(span<T>(start, end));
-            } else {
-                f(span<T>(start, data.end()));
-                return;
-            }
-        }
+        auto wait_start = WaitClock::now();
+        _sync->wait(*this);
+        wait_clock().stop(wait_start);
     }
 
-    Consumer&     _consumer;
+    Consumer*     _consumer;
     ConsumerSync* _sync         = nullptr;
     unsigned      _resolved_idx = 0;
 };
@@ -1373,30 +2412,65 @@ struct OutputConsumer
     void operator()(span<const uint8_t> data) const { write(STDOUT_FILENO, data.begin(), data.size()); }
 };
 
+/// For decompressing only for the side effects (eg. building an index)
+struct DiscardConsumer
+{
+    void operator()(span<const uint8_t>) const {}
+};
+
 struct LineCounter
 {
+    static constexpr aggregate aggregates = aggregate::line_feeds;
+
+    void operator()(span<const uint8_t> data) { lines.fetch_add(count_newlines(data)); }
+    void add_counts(const byte_counts_t& counts) { lines.fetch_add(counts['\n']); }
+
+    ~LineCounter() { fprintf(stdout, "%lu\n", lines.load()); }
+
+    std::atomic<size_t> lines = {0};
+};
+
+/** Interface of the consumers of order-insensitive aggregates of the output bytes (eg. the base composition of a FASTQ
+ * file): they get byte counts of parts of the output, in any order and from several threads. The random access chunks
+ * are never translated, their symbol counts are composed with the translation tables instead.
+ */
+struct HistogramConsumer
+{
+    static constexpr aggregate aggregates = aggregate::bytes;
+
     void operator()(span<const uint8_t> data)
     {
-        size_t         count = 0;
-        const uint8_t* p     = data.begin();
-        const uint8_t* e     = data.end();
+        uint32_t hist[256] = {};
+        translate::histogram(data, hist);
+        byte_counts_t counts;
+        std::copy(std::begin(hist), std::end(hist), counts.begin());
+        add_counts(counts);
+    }
 
-        for (;;) {
-            p = static_cast<const uint8_t*>(memchr(p, static_cast<int>('\n'), size_t(e - p)));
-            if (p != nullptr) {
-                count += 1;
-                p++;
-            } else {
-                break;
-            }
-        }
+    virtual void add_counts(const byte_counts_t& counts) = 0;
+
+    virtual ~HistogramConsumer() {}
+};
 
-        lines.fetch_add(count);
+/// Counts the occurrences of each byte of the output
+struct ByteCounter : public HistogramConsumer
+{
+    virtual void add_counts(const byte_counts_t& data_counts)
+    {
+        for (unsigned c = 0; c < 256; c++) {
+            if (data_counts[c] != 0) counts[c].fetch_add(data_counts[c]);
+        }
     }
 
-    ~LineCounter() { fprintf(stdout, "%lu\n", lines.load()); }
+    /// Prints the byte values and their number of occurrences, for the bytes present
+    ~ByteCounter()
+    {
+        for (unsigned c = 0; c < 256; c++) {
+            if (counts[c].load() != 0) fprintf(stdout, "%u\t%lu\n", c, counts[c].load());
+        }
+    }
 
-    std::atomic<size_t> lines = {0};
+    std::atomic<size_t> counts[256] = {};
 };
 
 /* namespace */
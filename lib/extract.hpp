@@ -0,0 +1,664 @@
+#ifndef EXTRACT_HPP
+#define EXTRACT_HPP
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Included after chunk_index.hpp, by gzip_decompress.hpp (which has no include guard)
+
+namespace pugz {
+
+/// A range of the decompressed stream: the bytes [begin, end), or the lines [begin, end) (from 0, with their line feed)
+struct OutputRange
+{
+    enum class unit_t { BYTES, LINES };
+
+    size_t begin;
+    size_t end;
+    unit_t unit;
+};
+
+/// Forwards the part of the output that falls in a range of the decompressed stream
+class RangeConsumer : public ConsumerInterface
+{
+  public:
+    using sink_t = std::function<void(span<const uint8_t>)>;
+
+    static constexpr size_t unknown_offset = SIZE_MAX;
+
+    /// The next output starts at the decoder state from, the output in range goes to sink
+    void reset(const ChunkIndex::entry_t& from, const OutputRange& range, sink_t sink)
+    {
+        _position = from.out_offset;
+        _lines    = from.lines;
+        _range    = range;
+        _sink     = std::move(sink);
+        if (range.unit == OutputRange::unit_t::BYTES) {
+            _begin = range.begin;
+            _end   = range.end;
+        } else {
+            _begin = range.begin == _lines ? _position : unknown_offset;
+            _end   = unknown_offset;
+        }
+    }
+
+    /// Offset in the decompressed stream of the next output, and number of line feeds before it
+    size_t position() const { return _position; }
+    size_t lines() const { return _lines; }
+
+    /// The range in bytes, unknown_offset until the line feeds bounding a range of lines are output
+    size_t begin() const { return _begin; }
+    size_t end() const { return _end; }
+
+    virtual bool output_ready() { return true; }
+
+    virtual void flush(span<const uint8_t> data, bool)
+    {
+        // The line feeds bounding the range can only be in data if it has enough bytes
+        if (_range.unit == OutputRange::unit_t::LINES
+            && ((_begin == unknown_offset && _range.begin - _lines <= data.size())
+                || (_end == unknown_offset && _range.end - _lines <= data.size())))
+            find_lines(data);
+
+        const size_t first = std::max(_position, _begin);
+        const size_t last  = std::min(_position + data.size(), _end);
+        if (first < last) _sink({data.begin() + (first - _position), last - first});
+        _position += data.size();
+        _lines += count_newlines(data);
+        add_output_size(data.size());
+    }
+
+  private:
+    /// Set the bounds of the range of lines that are in data
+    void find_lines(span<const uint8_t> data)
+    {
+        size_t lines = _lines;
+        for (const uint8_t* p = data.begin();; p++) {
+            p = static_cast<const uint8_t*>(memchr(p, static_cast<int>('\n'), size_t(data.end() - p)));
+            if (p == nullptr) return;
+
+            const size_t offset = _position + size_t(p + 1 - data.begin());
+            lines++;
+            if (lines == _range.begin) _begin = offset;
+            if (lines == _range.end) {
+                _end = offset;
+                return;
+            }
+        }
+    }
+
+    size_t      _position = 0;
+    size_t      _lines    = 0;
+    OutputRange _range    = {};
+    size_t      _begin    = 0;
+    size_t      _end      = 0;
+    sink_t      _sink     = {};
+};
+
+constexpr size_t RangeConsumer::unknown_offset;
+
+/// Sequential decoder resuming from a known state (an index entry), stopping once enough output was produced
+class RangeDecoder : public DeflateThread
+{
+  public:
+    using state_t = ChunkIndex::entry_t;
+
+    /// Output between the copies of the context at the block boundaries before a range (see decode())
+    static constexpr size_t context_copy_spacing = size_t(1) << 20;
+
+    RangeDecoder(const InputStream& in_stream, RangeConsumer& consumer)
+      : DeflateThread(in_stream, consumer)
+      , _range_consumer(consumer)
+    {
+        set_downstream(&_no_stop);
+    }
+
+    /** Decode from the state from until the end of range is output, or the stream ends. The output in range goes to
+     * sink. Returns whether it stopped before the end of the stream, the states of the last block boundary before the
+     * range (if any after from) and of where it stopped are then added to resume_points.
+     * The boundaries before the range only keep their position, but for a copy of the context every
+     * context_copy_spacing bytes: the context of the last one is decoded again from the last copy once done.
+     */
+    bool decode(const state_t&        from,
+                const OutputRange&    range,
+                RangeConsumer::sink_t sink,
+                std::vector<state_t>& resume_points)
+    {
+        start(from, range, std::move(sink));
+
+        const state_t* copied        = &from; // Last state before the range with a copy of its context
+        state_t        copy          = {};
+        size_t         before_bitpos = 0; // Last block boundary before the range, 0 if none after from
+        auto           res           = this->decompress_loop(_window, _range_consumer, [&]() {
+            const size_t out_offset = position();
+            if (out_offset >= _range_consumer.end()) return true;
+            if (out_offset <= _range_consumer.begin() && out_offset > from.out_offset) {
+                before_bitpos = _in_stream.position_bits();
+                if (out_offset >= copied->out_offset + context_copy_spacing) {
+                    copy   = state();
+                    copied = &copy;
+                }
+            }
+            return false;
+        });
+        if (res > block_result::CAUGHT_UP_DOWNSTREAM) throw_gzip_error(res);
+
+        const bool stopped = res == block_result::SUCCESS;
+        state_t    stop    = stopped ? state() : state_t{};
+        _range_consumer.flush(_window.flushable(), true);
+
+        if (before_bitpos != 0) {
+            if (before_bitpos != copied->bitpos) copy = state_at(*copied, before_bitpos);
+            resume_points.push_back(std::move(copy));
+        }
+        if (stopped) resume_points.push_back(std::move(stop));
+        return stopped;
+    }
+
+  private:
+    void start(const state_t& from, const OutputRange& range, RangeConsumer::sink_t sink)
+    {
+        set_initial_context({from.context.data(), from.context.size()});
+        _in_stream.set_position_bits(from.bitpos);
+        _range_consumer.reset(from, range, std::move(sink));
+    }
+
+    /// The state at the block boundary at bitpos, decoded again from the state from, without output
+    state_t state_at(const state_t& from, size_t bitpos)
+    {
+        start(from, {0, 0, OutputRange::unit_t::BYTES}, {});
+        auto res = this->decompress_loop(
+          _window, _range_consumer, [&]() { return _in_stream.position_bits() >= bitpos; });
+        if (res != block_result::SUCCESS) throw_gzip_error(res);
+        assert(_in_stream.position_bits() == bitpos);
+        return state();
+    }
+
+    /// Offset in the decompressed stream of the next decoded byte
+    size_t position() { return _range_consumer.position() + _window.flushable().size(); }
+
+    /// The state at a block boundary
+    state_t state()
+    {
+        auto context = _window.current_context();
+        return {_in_stream.position_bits(),
+                position(),
+                _range_consumer.lines() + count_newlines(_window.flushable()),
+                {context.begin(), context.end()},
+                {}};
+    }
+
+    RangeConsumer& _range_consumer;
+    ChunkBoundary  _no_stop{}; // Never stops: ranges are bounded by their output
+};
+
+constexpr size_t RangeDecoder::context_copy_spacing;
+
+/** Forwards the lines holding a pattern (as a fixed string) from a stream of whole lines
+ * The pattern is searched in the whole output, the lines around the matches are then delimited (like grep does).
+ */
+template<typename Sink> class LineFilter
+{
+  public:
+    LineFilter(span<const uint8_t> pattern, Sink& sink)
+      : _pattern(pattern)
+      , _sink(sink)
+    {}
+
+    void operator()(span<const uint8_t> data)
+    {
+        const uint8_t* p = data.begin();
+        if (!_partial.empty()) {
+            const uint8_t* eol  = find_eol(p, data.end());
+            const uint8_t* next = eol != nullptr ? eol + 1 : data.end();
+            _partial.insert(_partial.end(), p, next);
+            if (eol == nullptr) return;
+            finish();
+            p = next;
+        }
+
+        const uint8_t* last_eol = static_cast<const uint8_t*>(memrchr(p, '\n', size_t(data.end() - p)));
+        const uint8_t* lines_end = last_eol != nullptr ? last_eol + 1 : p;
+        while (p < lines_end) {
+            const auto* match = static_cast<const uint8_t*>(
+              memmem(p, size_t(lines_end - p), _pattern.begin(), _pattern.size()));
+            if (match == nullptr) break;
+
+            const uint8_t* line_start = static_cast<const uint8_t*>(memrchr(p, '\n', size_t(match - p)));
+            const uint8_t* line_end   = find_eol(match, lines_end) + 1;
+            output({line_start != nullptr ? line_start + 1 : p, line_end});
+            p = line_end;
+        }
+        _partial.assign(lines_end, data.end());
+    }
+
+    /// Filter the last line, if it has no line feed
+    void finish()
+    {
+        span<const uint8_t> line = {_partial.data(), _partial.size()};
+        if (memmem(line.begin(), line.size(), _pattern.begin(), _pattern.size()) != nullptr) output(line);
+        _partial.clear();
+    }
+
+    size_t matches() const { return _matches; }
+
+  private:
+    static const uint8_t* find_eol(const uint8_t* p, const uint8_t* end)
+    {
+        return static_cast<const uint8_t*>(memchr(p, '\n', size_t(end - p)));
+    }
+
+    void output(span<const uint8_t> line)
+    {
+        _sink(line);
+        _matches++;
+    }
+
+    span<const uint8_t>  _pattern;
+    Sink&                _sink;
+    std::vector<uint8_t> _partial = {}; // Start of a line split between two outputs
+    size_t               _matches = 0;
+};
+
+/** Random access to the decompressed stream of a gzip file with an index (see ChunkIndex), by bytes or by lines
+ * A range is decoded from the closest known state before it: an indexed chunk start, or the state of a recent
+ * extraction. Ranges spanning several indexed chunks are decoded by nthreads threads, kept for the life of the
+ * extractor, one chunk each and at most nthreads chunks ahead of the one being output. The output of each chunk is
+ * forwarded in order as it is decoded, the chunks ahead buffer at most max_buffered bytes each.
+ *
+ * The states where the recent extractions started and stopped are kept in a LRU cache, with their 32KiB context: a
+ * repeated extraction starts right before its range, the next one resumes where the previous stopped, and a range
+ * of bytes within a context is served without decoding.
+ *
+ * With the sketches of the index, a search only decodes the chunks that may hold the pattern.
+ */
+class Extractor
+{
+  public:
+    using state_t = ChunkIndex::entry_t;
+    using unit_t  = OutputRange::unit_t;
+
+    static constexpr size_t default_cache_size = 64; // Number of states kept, 32KiB each
+
+    Extractor(const byte*       in,
+              size_t            in_nbytes,
+              const ChunkIndex& index,
+              unsigned          nthreads   = 1,
+              size_t            cache_size = default_cache_size)
+      : _in_stream(deflate_stream(in, in_nbytes))
+      , _index(index)
+      , _nthreads(std::max(1u, nthreads))
+      , _cache_size(cache_size)
+    {
+        if (!index.matches(in, in_nbytes)) throw gzip_error("The index doesn't match the gzip file");
+    }
+
+    Extractor(const Extractor&) = delete;
+    Extractor& operator=(const Extractor&) = delete;
+
+    ~Extractor()
+    {
+        {
+            std::lock_guard<std::mutex> lock{_mut};
+            _stopping = true;
+            _job_cond.notify_all();
+        }
+        for (auto& thread : _threads)
+            thread.join();
+    }
+
+    /// Output the length bytes at offset in the decompressed stream to sink (less at its end), returns their number
+    template<typename Sink> size_t extract(size_t offset, size_t length, Sink&& sink)
+    {
+        size_t out     = 0;
+        auto   forward = [&](span<const uint8_t> data) {
+            sink(data);
+            out += data.size();
+        };
+        const OutputRange range = {offset, offset + std::min(length, SIZE_MAX - offset), unit_t::BYTES};
+        if (range.begin < range.end && !from_cache(range, forward)) extract_range(range, forward);
+        return out;
+    }
+
+    /** Output nlines lines from first_line (numbered from 0) to sink (less at the end of the stream), returns the
+     * number of bytes output. The last line has no line feed if the stream doesn't end with one.
+     */
+    template<typename Sink> size_t extract_lines(size_t first_line, size_t nlines, Sink&& sink)
+    {
+        size_t out     = 0;
+        auto   forward = [&](span<const uint8_t> data) {
+            sink(data);
+            out += data.size();
+        };
+        const OutputRange range = {first_line, first_line + std::min(nlines, SIZE_MAX - first_line), unit_t::LINES};
+        if (range.begin < range.end) extract_range(range, forward);
+        return out;
+    }
+
+    /** Output the lines holding pattern (a fixed string) to sink, decoding only the chunks whose sketch may hold it
+     * (all of them without sketches). Returns the number of lines found.
+     */
+    template<typename Sink> size_t grep(span<const uint8_t> pattern, Sink&& sink)
+    {
+        // A match starting in a chunk is in a line starting in the chunk, or in the line the chunk starts in. It might
+        // end in the next chunk.
+        const auto&              entries = _index.entries();
+        std::vector<OutputRange> ranges;
+        for (size_t chunk = 0; chunk < entries.size(); chunk++) {
+            const bool          last = chunk + 1 == entries.size();
+            span<const uint8_t> next = {};
+            if (!last) next = {entries[chunk + 1].sketch.data(), entries[chunk + 1].sketch.size()};
+            if (!NgramSketch::may_contain({entries[chunk].sketch.data(), entries[chunk].sketch.size()}, next, pattern))
+                continue;
+
+            const size_t begin = entries[chunk].lines;
+            const size_t end   = last ? SIZE_MAX : entries[chunk + 1].lines + 1;
+            if (!ranges.empty() && ranges.back().end >= begin) {
+                ranges.back().end = end;
+            } else {
+                ranges.push_back({begin, end, unit_t::LINES});
+            }
+        }
+        PRINT_DEBUG("grep: %lu ranges of lines to search\n", ranges.size());
+
+        LineFilter<Sink> filter{pattern, sink};
+        auto             forward = [&](span<const uint8_t> data) { filter(data); };
+        for (const auto& range : ranges)
+            extract_range(range, forward);
+        filter.finish();
+        return filter.matches();
+    }
+
+  private:
+    static constexpr size_t max_buffered = size_t(1) << 20; // Output of a chunk ahead kept before its decoder waits
+
+    struct worker_t
+    {
+        explicit worker_t(const InputStream& in_stream)
+          : decoder(in_stream, consumer)
+        {}
+
+        RangeConsumer consumer = {};
+        RangeDecoder  decoder;
+    };
+
+    /// The part of a multi-chunk range starting in a chunk, decoded by a worker thread
+    struct piece_t
+    {
+        piece_t(const state_t& from_, const OutputRange& range_)
+          : from(from_)
+          , range(range_)
+        {}
+
+        const state_t&       from;
+        OutputRange          range;
+        std::vector<uint8_t> output        = {}; // Decoded, not forwarded yet
+        std::vector<state_t> resume_points = {};
+        std::exception_ptr   error         = {};
+        bool                 done          = false;
+    };
+
+    /// The pieces of a range, decoded in order by the worker threads and forwarded in order by the calling thread
+    struct job_t
+    {
+        std::vector<piece_t> pieces    = {};
+        size_t               next      = 0; // Next piece to decode
+        size_t               forwarded = 0; // Piece being forwarded
+        unsigned             running   = 0; // Number of pieces being decoded
+        bool                 aborted   = false;
+    };
+
+    struct aborted_t
+    {};
+
+    static InputStream deflate_stream(const byte* in, size_t in_nbytes)
+    {
+        InputStream in_stream(in, in_nbytes);
+        in_stream.consume_header();
+        return {in_stream.in_next, in_stream.available()};
+    }
+
+    /** Where decoding from a state can start to output a range beginning at key(state): its output offset, or the first
+     * line starting after it (the first line feed after a state is the end of the line it is in). The start of the
+     * stream is the only state before line 0.
+     */
+    static size_t key(unit_t unit, const state_t& state)
+    {
+        if (unit == unit_t::BYTES || state.out_offset == 0) return state.out_offset;
+        return state.lines + 1;
+    }
+
+    template<typename Forward> void extract_range(const OutputRange& range, Forward& forward)
+    {
+        const size_t first_chunk = chunk_of(range.unit, range.begin);
+        const size_t last_chunk  = chunk_of(range.unit, range.end - 1);
+        if (_nthreads == 1 || first_chunk == last_chunk) {
+            if (!_worker) _worker.reset(new worker_t{_in_stream});
+            std::vector<state_t> resume_points;
+            _worker->decoder.decode(closest_state(range.unit, range.begin), range, forward, resume_points);
+            remember(resume_points);
+            return;
+        }
+
+        // Each piece outputs the part of the range starting in its chunk
+        const auto& entries = _index.entries();
+        job_t       job;
+        for (size_t chunk = first_chunk; chunk <= last_chunk; chunk++) {
+            OutputRange piece = range;
+            piece.begin       = std::max(range.begin, key(range.unit, entries[chunk]));
+            if (chunk + 1 < entries.size()) piece.end = std::min(range.end, key(range.unit, entries[chunk + 1]));
+            if (piece.begin >= piece.end) continue; // A line spanning the whole chunk
+            job.pieces.emplace_back(closest_state(range.unit, piece.begin), piece);
+        }
+
+        if (_threads.empty()) {
+            _threads.reserve(_nthreads);
+            for (unsigned thread_idx = 0; thread_idx < _nthreads; thread_idx++)
+                _threads.emplace_back([this]() { worker_main(); });
+        }
+
+        // The cache is only updated once the workers are done, they may be decoding from one of its states
+        std::vector<uint8_t>         output;
+        std::vector<state_t>         resume_points;
+        std::exception_ptr           error;
+        std::unique_lock<std::mutex> lock{_mut};
+        _job = &job;
+        _job_cond.notify_all();
+        while (job.forwarded < job.pieces.size() && !error) {
+            piece_t& piece = job.pieces[job.forwarded];
+            _done_cond.wait(lock, [&]() { return piece.done || !piece.output.empty(); });
+            output.swap(piece.output);
+            if (piece.done) {
+                error = piece.error;
+                for (auto& state : piece.resume_points)
+                    resume_points.push_back(std::move(state));
+                job.forwarded++;
+            }
+            _job_cond.notify_all(); // Room in the buffer of the piece, or for a piece more
+
+            lock.unlock();
+            try {
+                if (!output.empty()) forward(span<const uint8_t>{output.data(), output.size()});
+            } catch (...) {
+                error = std::current_exception();
+            }
+            output.clear();
+            lock.lock();
+        }
+
+        job.aborted = true;
+        _job_cond.notify_all();
+        _done_cond.wait(lock, [&]() { return job.running == 0; });
+        _job = nullptr;
+        lock.unlock();
+
+        remember(resume_points);
+        if (error) std::rethrow_exception(error);
+    }
+
+    /// Decode the pieces of the jobs with a decoder kept from one job to the next
+    void worker_main()
+    {
+        worker_t                     worker{_in_stream};
+        std::unique_lock<std::mutex> lock{_mut};
+        for (;;) {
+            _job_cond.wait(lock, [this]() {
+                return _stopping
+                       || (_job != nullptr && !_job->aborted && _job->next < _job->pieces.size()
+                           && _job->next < _job->forwarded + _nthreads);
+            });
+            if (_stopping) return;
+
+            job_t&   job   = *_job;
+            piece_t& piece = job.pieces[job.next++];
+            job.running++;
+            lock.unlock();
+            try {
+                auto append = [&](span<const uint8_t> data) {
+                    std::unique_lock<std::mutex> append_lock{_mut};
+                    _job_cond.wait(append_lock,
+                                   [&]() { return job.aborted || piece.output.size() < max_buffered; });
+                    if (job.aborted) throw aborted_t{};
+                    piece.output.insert(piece.output.end(), data.begin(), data.end());
+                    _done_cond.notify_all();
+                };
+                worker.decoder.decode(piece.from, piece.range, append, piece.resume_points);
+            } catch (...) {
+                piece.error = std::current_exception();
+            }
+            lock.lock();
+            piece.done = true;
+            job.running--;
+            _done_cond.notify_all();
+        }
+    }
+
+    /// Index of the last indexed chunk from which a range beginning at begin can be output
+    size_t chunk_of(unit_t unit, size_t begin) const
+    {
+        const auto& entries = _index.entries();
+        auto        after   = std::upper_bound(
+          entries.begin() + 1, entries.end(), begin, [&](size_t pos, const state_t& entry) {
+              return pos < key(unit, entry);
+          });
+        return size_t(after - entries.begin()) - 1;
+    }
+
+    /// The closest known state before a range beginning at begin, a cached state is marked as recently used
+    const state_t& closest_state(unit_t unit, size_t begin)
+    {
+        const state_t* closest = &_index.entries()[chunk_of(unit, begin)];
+        auto           cached  = _cache.end();
+        for (auto it = _cache.begin(); it != _cache.end(); ++it) {
+            if (key(unit, *it) <= begin && it->out_offset > closest->out_offset) {
+                closest = &*it;
+                cached  = it;
+            }
+        }
+        if (cached != _cache.end()) _cache.splice(_cache.begin(), _cache, cached);
+        return *closest;
+    }
+
+    /// Output a range of bytes if it is within a cached context
+    template<typename Forward> bool from_cache(const OutputRange& range, Forward& forward)
+    {
+        for (auto it = _cache.begin(); it != _cache.end(); ++it) {
+            const size_t context_start = it->out_offset - std::min(it->out_offset, ChunkIndex::context_size);
+            if (range.begin < context_start || range.end > it->out_offset) continue;
+
+            const uint8_t* context_end = it->context.data() + it->context.size();
+            forward(span<const uint8_t>{context_end - (it->out_offset - range.begin), range.end - range.begin});
+            _cache.splice(_cache.begin(), _cache, it);
+            return true;
+        }
+        return false;
+    }
+
+    void remember(std::vector<state_t>& states)
+    {
+        for (auto& state : states) {
+            bool known = false;
+            for (const auto& cached : _cache)
+                known |= cached.bitpos == state.bitpos;
+            if (!known) _cache.push_front(std::move(state));
+        }
+        while (_cache.size() > _cache_size)
+            _cache.pop_back();
+    }
+
+    const InputStream         _in_stream;
+    const ChunkIndex&         _index;
+    const unsigned            _nthreads;
+    const size_t              _cache_size;
+    std::list<state_t>        _cache  = {}; // Most recently used first
+    std::unique_ptr<worker_t> _worker = {}; // Decoder of the single threaded extractions, kept for its window
+
+    // Threads of the multi-chunk extractions, started by the first one
+    std::mutex               _mut{};
+    std::condition_variable  _job_cond{}; // Workers wait for a piece, or for room in the buffer of theirs
+    std::condition_variable  _done_cond{}; // The calling thread waits for output
+    job_t*                   _job      = nullptr;
+    bool                     _stopping = false;
+    std::vector<std::thread> _threads{};
+};
+
+constexpr size_t Extractor::default_cache_size;
+constexpr size_t Extractor::max_buffered;
+
+/** Output the length bytes at offset in the decompressed stream of the gzip file (in, in_nbytes) to sink, using an
+ * index of the file. Returns the number of bytes output (less than length at the end of the stream).
+ * See Extractor to extract several ranges of the same file.
+ */
+template<typename Sink>
+size_t
+extract(const byte*       in,
+        size_t            in_nbytes,
+        const ChunkIndex& index,
+        size_t            offset,
+        size_t            length,
+        Sink&&            sink,
+        unsigned          nthreads = 1)
+{
+    Extractor extractor{in, in_nbytes, index, nthreads, 0};
+    return extractor.extract(offset, length, sink);
+}
+
+/// Output the lines holding pattern of the gzip file (in, in_nbytes) to sink, using an index of the file (see grep())
+template<typename Sink>
+size_t
+grep(const byte*         in,
+     size_t              in_nbytes,
+     const ChunkIndex&   index,
+     span<const uint8_t> pattern,
+     Sink&&              sink,
+     unsigned            nthreads = 1)
+{
+    Extractor extractor{in, in_nbytes, index, nthreads, 0};
+    return extractor.grep(pattern, sink);
+}
+
+/** Output nlines lines from first_line (numbered from 0) of the gzip file (in, in_nbytes) to sink, using an index of
+ * the file. Returns the number of bytes output. Read N of a FASTQ file is the 4 lines from 4N.
+ */
+template<typename Sink>
+size_t
+extract_lines(const byte*       in,
+              size_t            in_nbytes,
+              const ChunkIndex& index,
+              size_t            first_line,
+              size_t            nlines,
+              Sink&&            sink,
+              unsigned          nthreads = 1)
+{
+    Extractor extractor{in, in_nbytes, index, nthreads, 0};
+    return extractor.extract_lines(first_line, nlines, sink);
+}
+
+} // namespace pugz
+
+#endif // EXTRACT_HPP
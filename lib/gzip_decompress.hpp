@@ -30,185 +30,1025 @@
 #include "gzip_constants.h"
 
 #include "libdeflate.h"
+#include <algorithm>
 #include <exception>
 #include <vector>
+#include <deque>
+#include <memory>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
 
 #include "deflate_decompress.hpp" //FIXME
+#include "chunk_index.hpp"
+#include "extract.hpp"
+#include "topology.hpp"
 
-template<typename Consumer>
-static enum libdeflate_result
-libdeflate_gzip_decompress(const byte* in, size_t in_nbytes, unsigned nthreads, Consumer& consumer, ConsumerSync* sync)
+/// A range of the compressed stream, decoded as a unit by whichever worker dequeues it
+struct ChunkTask
 {
-    // FIXME: handle header parsing inside DeflateThread*, allowing multimember gzip files
-    InputStream in_stream2(in, in_nbytes);
-    in_stream2.consume_header();
-    InputStream in_stream(in_stream2.in_next, in_stream2.available());
-    size_t      in_size = in_stream2.available();
-    nthreads            = std::min(1 + unsigned(in_size >> 21), nthreads);
-
-    PRINT_DEBUG("Using %u threads\n", nthreads);
-
-    std::vector<std::thread>    threads;
-    std::vector<DeflateThread*> deflate_threads(nthreads);
-
-    std::atomic<size_t>     nready = {0};
-    std::condition_variable ready;
-    std::mutex              ready_mtx;
-    std::exception_ptr      exception;
-
-    threads.reserve(nthreads);
-
-    // Sections of file decompressed sequentially
-    size_t max_section_size = nthreads * (32ull << 20); // 32MB per thread
-    size_t section_size     = std::min(max_section_size, in_size);
-    size_t n_sections       = (in_size + section_size - 1) / section_size;
-    if (nthreads == 1) n_sections = 1;
-    section_size = in_size / n_sections;
-
-    // Section are chunked to nethreads
-    size_t chunk_size = section_size / nthreads;
-    // The first thread is working with resolved context so its faster
-    size_t first_chunk_size = chunk_size + (4UL << 20); // FIXME: ratio instead of delta
-    if (nthreads > 1) {
-        chunk_size       = (nthreads * chunk_size - first_chunk_size) / (nthreads - 1);
-        first_chunk_size = section_size - chunk_size * (nthreads - 1);
-    }
-
-    for (unsigned chunk_idx = 0; chunk_idx < nthreads; chunk_idx++) {
-        if (chunk_idx == 0) {
-
-            threads.emplace_back([&]() {
-                ConsumerWrapper<Consumer> consumer_wrapper{consumer, sync};
-                consumer_wrapper.set_chunk_idx(0, nthreads == 1);
-                DeflateThread deflate_thread(in_stream, consumer_wrapper);
-                PRINT_DEBUG("chunk 0 is %p\n", (void*)&deflate_thread);
-                {
-                    std::unique_lock<std::mutex> lock{ready_mtx};
-                    deflate_threads[0] = &deflate_thread;
-                    nready++;
-                    ready.notify_all();
-
-                    while (nready != nthreads)
-                        ready.wait(lock);
-                }
+    unsigned       idx           = 0;
+    size_t         start         = 0;       /// Offset in bytes where the chunk starts (where sync() starts searching)
+    size_t         stop          = 0;       /// Offset in bytes where the next chunk starts
+    bool           is_last       = false;   /// Last chunk of the stream
+    ChunkBoundary* upstream      = nullptr; /// Context left by the previous chunk (nullptr for the first chunk)
+    bool           sequential    = false;   /// Decoded by the worker of the previous chunk, once done: context known
+    ChunkBoundary* downstream    = nullptr; /// Where the chunk stops and leaves the context of the next one
+    size_t         synced_bitpos = ChunkBoundary::unset_stop_pos; /// First block, if synced ahead (see reserve())
+    const uint8_t* context       = nullptr; /// Initial context, when known from an index (see use_index())
+    NgramSketch*   sketch        = nullptr; /// Where to sketch the output, when recording an index with sketches
+};
 
-                try {
-                    const byte* last_unmapped = details::round_up<details::huge_page_size>(in);
-
-                    // First chunk of first section: no context needed
-                    deflate_thread.set_end_block(first_chunk_size * 8);
-                    deflate_thread.go(0);
-
-                    // First chunks of next sections get their contexts from the last chunk of the previous section
-                    auto& prev_chunk = *deflate_threads[nthreads - 1];
-                    for (unsigned section_idx = 1; section_idx < n_sections && nready == nthreads; section_idx++) {
-                        const size_t start = section_idx * section_size;
-                        const size_t stop  = start + first_chunk_size;
-
-                        // Get the context and position of the first block of the section
-                        size_t resume_bitpos;
-                        { // Synchronization point
-                            auto ctx = prev_chunk.get_context();
-                            deflate_thread.set_initial_context(ctx.first);
-                            resume_bitpos = ctx.second;
-                        }
-
-                        // Unmmap the section previously decompressed (free RSS, usefull for large files)
-                        const byte* unmap_end
-                          = details::round_down<details::huge_page_size>(in_stream.data.begin() + resume_bitpos / 8);
-                        sys::check_ret(munmap(const_cast<byte*>(last_unmapped), size_t(unmap_end - last_unmapped)),
-                                       "munmap");
-                        last_unmapped = unmap_end;
-
-                        PRINT_DEBUG("%p chunk 0 of section %u: [%lu<=%lu, %lu[\n",
-                                    (void*)&deflate_thread,
-                                    section_idx,
-                                    start * 8,
-                                    resume_bitpos,
-                                    stop);
-
-                        assert(resume_bitpos >= start * 8);
-                        assert(resume_bitpos < stop * 8);
-                        deflate_thread.set_end_block(stop * 8);
-                        consumer_wrapper.set_section_idx(section_idx);
-                        deflate_thread.go(resume_bitpos);
-                    }
-
-                } catch (...) {
-                    std::unique_lock<std::mutex> lock{ready_mtx};
-                    if (!exception) {
-                        exception = std::current_exception();
-                        nready    = 0; // Stop the thread pool
-                    }
-                    return;
-                }
+/** Block boundaries of the compressed stream, found by all the workers before decompressing (see
+ * DecompressOptions::prescan)
+ * The stream is cut into slices, claimed by the workers as they go. In each slice, the first block is synced, then the
+ * next blocks are checked one after the other, each starting where the previous one ended, until the end of the slice.
+ * The chunks can then start at known block starts (no sync) and be sized from the decompressed size of their blocks.
+ */
+class BlockMap
+{
+  public:
+    static constexpr size_t slice_size = 2ull << 20;
+
+    struct block_t
+    {
+        size_t bitpos;   /// Where the block starts in the compressed stream
+        size_t out_size; /// Decompressed size of the block
+    };
+
+    explicit BlockMap(size_t in_size)
+      : _slices((in_size + slice_size - 1) / slice_size)
+      , _in_size(in_size)
+    {}
+
+    BlockMap(const BlockMap&) = delete;
+    BlockMap& operator=(const BlockMap&) = delete;
+
+    /// Scan slices until there are none left, then wait for the other workers to finish theirs
+    void scan(DeflateParser& parser)
+    {
+        for (size_t slice_idx; (slice_idx = _next_slice++) < _slices.size();) {
+            scan_slice(parser, slice_idx);
+
+            std::lock_guard<std::mutex> lock{_mut};
+            if (++_done_slices == _slices.size()) {
+                merge();
+                _done_cond.notify_all();
+            }
+        }
+
+        std::unique_lock<std::mutex> lock{_mut};
+        _done_cond.wait(lock, [this]() { return _done_slices == _slices.size(); });
+    }
+
+    /// The blocks in stream order (complete once scan() returned)
+    const std::vector<block_t>& blocks() const { return _blocks; }
+
+  private:
+    struct slice_t
+    {
+        std::vector<block_t> blocks = {};
+        size_t               end    = 0; // Where the last block ends
+    };
+
+    void scan_slice(DeflateParser& parser, size_t slice_idx)
+    {
+        slice_t&     slice     = _slices[slice_idx];
+        const size_t slice_end = 8 * std::min(_in_size, (slice_idx + 1) * slice_size);
+
+        size_t pos = parser.find_block(8 * slice_idx * slice_size);
+        while (pos < slice_end) {
+            size_t     out_size;
+            const auto res = parser.check_block(pos, out_size);
+            if (res == DeflateParser::block_result::SUCCESS || res == DeflateParser::block_result::LAST_BLOCK) {
+                slice.blocks.push_back({pos, out_size});
+                slice.end = pos = parser.position_bits();
+                if (res == DeflateParser::block_result::LAST_BLOCK) break;
+                continue;
+            }
+
+            // The sync was a false positive: drop the blocks that followed it and resync
+            PRINT_DEBUG("block map: invalid block at %lu (%s), resyncing\n",
+                        pos,
+                        DeflateParser::block_result_to_cstr(res));
+            const size_t false_start = slice.blocks.empty() ? pos : slice.blocks.front().bitpos;
+            slice.blocks.clear();
+            slice.end = 0;
+            pos       = parser.find_block(false_start + 1);
+        }
+    }
+
+    /// Chains of consecutive slices join where the chain of the first slice ends
+    void merge()
+    {
+        size_t end = 0;
+        for (const auto& slice : _slices) {
+            for (const auto& block : slice.blocks) {
+                if (block.bitpos >= end) _blocks.push_back(block);
+            }
+            end = std::max(end, slice.end);
+        }
+        PRINT_DEBUG("block map: %lu blocks\n", _blocks.size());
+    }
+
+    std::vector<slice_t>    _slices;
+    size_t                  _in_size;
+    std::atomic<size_t>     _next_slice{0};
+    std::mutex              _mut{};
+    std::condition_variable _done_cond{};
+    size_t                  _done_slices = 0;
+    std::vector<block_t>    _blocks      = {};
+};
+
+/** Decoding speed measured on the previous chunks, in compressed bytes per second of busy time
+ * Random access chunks are slower than chunks decoded with a resolved context (16bits pass and translation), and both
+ * depend on the local compressibility of the stream.
+ * Also tracks the compression ratio, which bounds the size of random access chunks (their output is buffered).
+ */
+class ChunkThroughput
+{
+  public:
+    static constexpr double smoothing = 0.5; // Weight of the last measure in the recent speed
+    // Speedup assumed for resolved chunks until it is measured (was a 4MB delta over 32MB chunks)
+    static constexpr double default_resolved_speedup = 1.125;
 
-                if (nthreads == 1) deflate_thread.get_context();
-            });
+    void add(bool resolved, size_t nbytes, double seconds, size_t out_nbytes)
+    {
+        if (nbytes == 0) return;
+        // Follows increases immediately, decreases smoothly
+        const double ratio = double(out_nbytes) / double(nbytes);
+        _ratio             = std::max(ratio, smoothing * ratio + (1 - smoothing) * _ratio);
+
+        if (seconds <= 0) return;
+        const double rate = double(nbytes) / seconds;
+        if (resolved) {
+            _resolved_rate = _resolved_rate > 0 ? smoothing * rate + (1 - smoothing) * _resolved_rate : rate;
         } else {
-            threads.emplace_back([&, chunk_idx]() {
-                ConsumerWrapper<Consumer> consumer_wrapper{consumer, sync};
-                consumer_wrapper.set_chunk_idx(chunk_idx, chunk_idx == nthreads - 1);
-                DeflateThreadRandomAccess deflate_thread{in_stream, consumer_wrapper};
-                PRINT_DEBUG("chunk %u is %p\n", chunk_idx, (void*)&deflate_thread);
-                {
-                    std::unique_lock<std::mutex> lock{ready_mtx};
-                    deflate_threads[chunk_idx] = &deflate_thread;
-                    nready++;
-                    ready.notify_all();
-
-                    while (nready != nthreads)
-                        ready.wait(lock);
-
-                    deflate_thread.set_upstream(deflate_threads[chunk_idx - 1]);
-                }
+            _recent_rate = _recent_rate > 0 ? smoothing * rate + (1 - smoothing) * _recent_rate : rate;
+            _total_bytes += double(nbytes);
+            _total_seconds += seconds;
+        }
+    }
+
+    /// Whether random access chunks were measured
+    bool measured() const { return _total_seconds > 0; }
+
+    /// Speed of the last random access chunks
+    double recent_rate() const { return _recent_rate; }
+
+    /// Speed of all the random access chunks
+    double average_rate() const { return _total_bytes / _total_seconds; }
+
+    /// Recent compression ratio (0 until measured)
+    double ratio() const { return _ratio; }
+
+    /// How much faster a chunk with a resolved context decodes
+    double resolved_speedup() const
+    {
+        return _resolved_rate > 0 && _recent_rate > 0 ? _resolved_rate / _recent_rate : default_resolved_speedup;
+    }
+
+  private:
+    double _recent_rate   = 0;
+    double _resolved_rate = 0;
+    double _total_bytes   = 0;
+    double _total_seconds = 0;
+    double _ratio         = 0;
+};
+
+/** Shared queue of chunk tasks
+ * The compressed stream is cut into more chunks than threads. Idle workers dequeue the next unsynced range in stream
+ * order, so a slow chunk only delays the chunks waiting for its context instead of stalling every thread at a section
+ * barrier.
+ *
+ * Chunk sizes are decided when they are dequeued, from the speed measured on the previous chunks: each chunk should
+ * last a fixed fraction of the estimated remaining time at the local decoding speed. Chunks shrink in slow (highly
+ * compressed) regions, so that contexts are handed off at a steady pace, and toward the end of the stream, so that all
+ * threads finish together.
+ *
+ * A worker that would wait for another chunk (for its context or output turn) can reserve the next chunk instead and
+ * find its first block ahead of time: the worker that dequeues it starts decoding right away.
+ *
+ * With a block map, chunks start at known blocks instead (see block_stop()). With an index, chunks are the indexed
+ * ones, and start with a known context. When recording an index, chunks are index_chunk_size apart whatever the number
+ * of threads, so that the index of a stream is the same for any -t: a single thread decodes them one after the other,
+ * each one starting with the context left by the previous one.
+ */
+class ChunkScheduler
+{
+  public:
+    // Chunks must be small enough to balance the load, but large enough to amortize the sync and the 16bits pass
+    static constexpr size_t   min_chunk_size    = 2ull << 20;
+    static constexpr size_t   max_chunk_size    = 32ull << 20;
+    static constexpr unsigned chunks_per_thread = 4;
+    // Spacing of the chunks recorded in an index: an access from the index decodes at most this much input first
+    static constexpr size_t index_chunk_size = min_chunk_size;
+    // Random access chunks are sized for the output of the most compressed part of the chunk to fit their buffer
+    static constexpr double ratio_margin = 1.5;
+    // Output of a random access chunk that fits its buffer as 16bits symbols (the rest is decoded sequentially)
+    static constexpr size_t random_access_capacity
+      = DeflateThreadRandomAccess::buffer_virtual_size / sizeof(uint16_t) - DeflateThreadRandomAccess::spill_margin;
+
+    /** The block map, if any, must be complete before the first chunk is dequeued. The consumed input is released if
+     * mapping is the start of the file mapping holding the stream, it is left untouched if mapping is null.
+     */
+    ChunkScheduler(const InputStream& in_stream,
+                   const byte*        mapping,
+                   unsigned           nthreads,
+                   ChunkThroughput&   throughput,
+                   const BlockMap*    block_map = nullptr)
+      : _in_begin(in_stream.data.begin())
+      , _in_size(in_stream.size())
+      , _nthreads(nthreads)
+      , _throughput(throughput)
+      , _block_map(block_map)
+      , _last_released(mapping != nullptr ? details::round_up<details::huge_page_size>(mapping) : nullptr)
+    {}
+
+    ChunkScheduler(const ChunkScheduler&) = delete;
+    ChunkScheduler& operator=(const ChunkScheduler&) = delete;
+
+    /// Hand out the chunks of an index (matching the stream), before the first chunk is dequeued
+    void use_index(const ChunkIndex& index) { _index = &index; }
+
+    /// Keep the contexts, count the lines and sketch the output of the chunks (if sketches) for fill_index(), before
+    /// the first chunk is dequeued
+    void record_index(bool sketches = false)
+    {
+        _record_index    = true;
+        _record_sketches = sketches;
+    }
+
+    /// Whether the lines of the chunks should be counted (see done())
+    bool recording_index() const { return _record_index; }
+
+    /// Add the chunks of a successful decompression to an index
+    void fill_index(ChunkIndex& index)
+    {
+        size_t out_offset = 0, lines = 0;
+        for (size_t chunk_idx = 0; chunk_idx < _chunks.size(); chunk_idx++) {
+            span<const uint8_t> sketch = {};
+            if (_record_sketches) {
+                if (chunk_idx + 1 < _sketches.size()) _sketches[chunk_idx].add_boundary(_sketches[chunk_idx + 1]);
+                sketch = {_sketches[chunk_idx].bits().data(), _sketches[chunk_idx].bits().size()};
+            }
+            if (chunk_idx == 0) {
+                index.add(0, 0, 0, {}, sketch);
+            } else {
+                const ChunkBoundary& boundary = _boundaries[chunk_idx - 1];
+                index.add(boundary.stopped_at(), out_offset, lines, boundary.kept_context(), sketch);
+            }
+            out_offset += _chunks[chunk_idx].out_nbytes;
+            lines += _chunks[chunk_idx].out_lines;
+        }
+    }
+
+    /// Dequeue the next chunk, returns false when there is no more work
+    bool next(ChunkTask& task)
+    {
+        std::unique_lock<std::mutex> lock{_mut};
+        // Reserved chunks go first, as the next chunks wait for their context. Their sync is almost done.
+        _synced_cond.wait(lock, [this]() { return _aborted || _reserved.empty() || _reserved.front().synced; });
+        if (_aborted) return false;
+        if (!_reserved.empty()) {
+            task = _reserved.front().task;
+            _reserved.pop_front();
+            return true;
+        }
+        if (_next_start == _in_size) return false;
+
+        new_task(task);
+        return true;
+    }
+
+    /** Reserve the next chunk, for a worker about to wait, to sync it ahead of time. Returns false if there is no chunk
+     * left, or if enough chunks are already reserved. The chunk is handed out by next() once synced() is called.
+     */
+    bool reserve(ChunkTask& task)
+    {
+        std::lock_guard<std::mutex> lock{_mut};
+        if (_aborted || _block_map != nullptr || _index != nullptr || _boundaries.empty() || _next_start == _in_size
+            || _reserved.size() >= _nthreads)
+            return false;
+
+        new_task(task);
+        _reserved.push_back({task, false});
+        return true;
+    }
+
+    /// Publish the first block of a reserved chunk (unset_stop_pos if it wasn't found: the chunk syncs itself)
+    void synced(const ChunkTask& task, size_t synced_bitpos)
+    {
+        std::lock_guard<std::mutex> lock{_mut};
+        for (auto& reserved : _reserved) {
+            if (reserved.task.idx != task.idx) continue;
+            reserved.task.synced_bitpos = synced_bitpos;
+            reserved.synced             = true;
+        }
+        _synced_cond.notify_all();
+    }
+
+    /** Mark a chunk as done, and account the time it spent decoding (excluding the waits for other chunks) and its
+     * output size and lines (when recording an index). The pages of the input before the first pending chunk are
+     * released if it's a file mapping (frees RSS, usefull for large files). They stay mapped: the file mapping is
+     * unmapped as a whole when the file is closed, which would unmap anything the kernel placed in a hole. So are the
+     * contexts of their boundaries.
+     */
+    void done(const ChunkTask& task, WaitClock::clock::duration busy, size_t out_nbytes, size_t out_lines)
+    {
+        std::lock_guard<std::mutex> lock{_mut};
+        _throughput.add(task.upstream == nullptr || task.sequential,
+                        task.stop - task.start,
+                        std::chrono::duration_cast<std::chrono::duration<double>>(busy).count(),
+                        out_nbytes);
+        _chunks[task.idx].done       = true;
+        _chunks[task.idx].out_nbytes = out_nbytes;
+        _chunks[task.idx].out_lines  = out_lines;
+
+        size_t first_pending = _first_pending;
+        while (first_pending < _chunks.size() && _chunks[first_pending].done)
+            first_pending++;
+        if (first_pending == _first_pending) return;
+        for (size_t chunk_idx = std::max(_first_pending, size_t(1)); chunk_idx < first_pending; chunk_idx++)
+            _boundaries[chunk_idx - 1].release();
+        _first_pending = first_pending;
+
+        const size_t pending_start = first_pending < _chunks.size() ? _chunks[first_pending].start : _next_start;
+        const byte*  release_end   = details::round_down<details::huge_page_size>(_in_begin + pending_start);
+        if (_last_released != nullptr && release_end > _last_released) {
+            const size_t release_size = size_t(release_end - _last_released);
+            sys::check_ret(madvise(const_cast<byte*>(_last_released), release_size, MADV_DONTNEED), "madvise");
+            _last_released = release_end;
+        }
+    }
+
+    /// Stop handing out chunks
+    void abort()
+    {
+        std::lock_guard<std::mutex> lock{_mut};
+        _aborted = true;
+        _synced_cond.notify_all();
+    }
+
+  private:
+    void new_task(ChunkTask& task)
+    {
+        task               = {};
+        task.idx           = unsigned(_chunks.size());
+        task.start         = _next_start;
+        task.synced_bitpos = _next_synced_bitpos;
+        task.upstream      = _boundaries.empty() ? nullptr : &_boundaries.back();
+        task.sequential    = task.upstream != nullptr && _nthreads == 1;
+
+        size_t stop_bitpos;
+        if (_index != nullptr) {
+            stop_bitpos = index_stop(task);
+        } else {
+            const size_t chunk_size = _record_index ? index_chunk_size_at() : next_chunk_size(task.upstream == nullptr);
+            stop_bitpos             = 8 * (_next_start + chunk_size);
+            if (_block_map != nullptr) stop_bitpos = block_stop(task, stop_bitpos);
+        }
+        task.stop    = stop_bitpos / 8;
+        task.is_last = task.stop == _in_size;
+        _boundaries.emplace_back(stop_bitpos);
+        if (_record_index) _boundaries.back().keep_context();
+        if (_record_sketches) {
+            _sketches.emplace_back();
+            task.sketch = &_sketches.back();
+        }
+        task.downstream = &_boundaries.back();
+        _chunks.push_back({task.start, false, 0, 0});
+        _next_start = task.stop;
+
+        PRINT_DEBUG("chunk %u: [%lu, %lu[\n", task.idx, task.start * 8, task.stop * 8);
+    }
+
+    /// With an index, the chunk stops at the next indexed chunk
+    size_t index_stop(ChunkTask& task)
+    {
+        const auto& entries = _index->entries();
+        if (task.idx != 0) task.context = entries[task.idx].context.data();
+        if (task.idx + 1 == entries.size()) return 8 * _in_size;
+
+        _next_synced_bitpos = entries[task.idx + 1].bitpos;
+        return _next_synced_bitpos;
+    }
+
+    /** With a block map, the chunk stops at the first known block after stop_bitpos, which is where the next chunk
+     * starts (no sync). A random access chunk also stops before its output overflows its buffer.
+     */
+    size_t block_stop(const ChunkTask& task, size_t stop_bitpos)
+    {
+        _next_synced_bitpos = ChunkBoundary::unset_stop_pos;
+
+        const auto&  blocks    = _block_map->blocks();
+        const size_t first_pos = task.synced_bitpos != ChunkBoundary::unset_stop_pos ? task.synced_bitpos
+                                                                                        : 8 * task.start;
+        auto block = std::lower_bound(
+          blocks.begin(), blocks.end(), first_pos, [](const BlockMap::block_t& b, size_t p) { return b.bitpos < p; });
+        if (block == blocks.end()) return stop_bitpos;
+
+        size_t out_size = block->out_size;
+        for (++block; block != blocks.end() && block->bitpos < stop_bitpos; ++block) {
+            if (task.upstream != nullptr && out_size + block->out_size > random_access_capacity) break;
+            out_size += block->out_size;
+        }
+        if (block == blocks.end()) return stop_bitpos; // Unknown blocks after the end of the map
+        PRINT_DEBUG("chunk %u: stops at block %lu, %lu bytes expected\n", task.idx, block->bitpos, out_size);
+        _next_synced_bitpos = block->bitpos;
+        return block->bitpos;
+    }
+
+    /// Recording an index, the chunks are index_chunk_size long, but the last one (up to twice as long)
+    size_t index_chunk_size_at() const
+    {
+        const size_t remaining = _in_size - _next_start;
+        return remaining < 2 * index_chunk_size ? remaining : index_chunk_size;
+    }
+
+    size_t next_chunk_size(bool resolved) const
+    {
+        const size_t remaining = _in_size - _next_start;
+        if (_nthreads == 1) return remaining;
+
+        const double parts = chunks_per_thread * _nthreads;
+        double       size;
+        if (_throughput.measured()) {
+            // A fraction of the estimated remaining time, at the speed of the last chunks
+            size = _throughput.recent_rate() * (double(remaining) / _throughput.average_rate()) / parts;
+        } else {
+            size = double(remaining) / parts;
+        }
+        if (resolved) {
+            size *= _throughput.resolved_speedup();
+        } else if (_throughput.ratio() > 0) {
+            // Expected to fit in the buffer as 16bits symbols, otherwise the end of the chunk is decoded sequentially
+            size = std::min(size, double(random_access_capacity) / (ratio_margin * _throughput.ratio()));
+        }
+
+        size_t chunk_size = std::min(max_chunk_size, std::max(min_chunk_size, size_t(size)));
+        // Do not leave a tail too small to be synced and decoded efficiently
+        if (remaining < chunk_size + min_chunk_size)
+            chunk_size = remaining >= 2 * min_chunk_size ? remaining / 2 : remaining;
+        return chunk_size;
+    }
+
+    struct chunk_state
+    {
+        size_t start;
+        bool   done;
+        size_t out_nbytes;
+        size_t out_lines;
+    };
+
+    struct reserved_chunk
+    {
+        ChunkTask task;
+        bool      synced;
+    };
+
+    std::mutex                 _mut{};
+    const byte*                _in_begin;
+    size_t                     _in_size;
+    unsigned                   _nthreads;
+    ChunkThroughput&           _throughput;
+    const BlockMap*            _block_map;
+    const ChunkIndex*          _index           = nullptr;
+    bool                       _record_index    = false;
+    bool                       _record_sketches = false;
+    std::deque<NgramSketch>    _sketches{}; // Of the chunks, when recording sketches (stable addresses)
+    size_t                     _next_start         = 0;
+    size_t                     _next_synced_bitpos = ChunkBoundary::unset_stop_pos; // Known first block of next chunk
+    size_t                     _first_pending = 0;
+    std::deque<ChunkBoundary>  _boundaries    = {}; // Stable addresses: chunks keep pointers to their boundaries
+    std::vector<chunk_state>   _chunks        = {};
+    std::deque<reserved_chunk> _reserved      = {}; // Chunks being synced ahead of time, in stream order
+    std::condition_variable    _synced_cond{};
+    const byte*                _last_released; // Null if the input is not released
+    bool                       _aborted = false;
+};
+
+/// A gzip stream being decompressed, shared by the workers
+template<typename Consumer> struct DecompressJob
+{
+    DecompressJob(const InputStream& in_stream_,
+                  Consumer&          consumer_,
+                  ConsumerSync*      sync_,
+                  ChunkScheduler&    scheduler_,
+                  BlockMap*          block_map_ = nullptr)
+      : in_stream(in_stream_)
+      , consumer(consumer_)
+      , sync(sync_)
+      , scheduler(scheduler_)
+      , block_map(block_map_)
+    {}
+
+    DecompressJob(const DecompressJob&) = delete;
+    DecompressJob& operator=(const DecompressJob&) = delete;
+
+    /// Keep the first error, the other workers fail because of it
+    void set_exception(std::exception_ptr e)
+    {
+        std::lock_guard<std::mutex> lock{exception_mtx};
+        if (!exception) exception = e;
+    }
+
+    const InputStream& in_stream;
+    Consumer&          consumer;
+    ConsumerSync*      sync;
+    ChunkScheduler&    scheduler;
+    BlockMap*          block_map;                              /// Built by the workers before decompressing, if not null
+    unsigned           litlen_tablebits = LITLEN_MIN_TABLEBITS; /// Litlen main table bits of the decoders
+    std::mutex         exception_mtx{};
+    std::exception_ptr exception = nullptr;
+};
 
-                try {
-                    const size_t chunk_offset_start = first_chunk_size + chunk_size * (chunk_idx - 1);
-                    const size_t chunk_offset_stop  = first_chunk_size + chunk_size * chunk_idx;
-
-                    for (unsigned section_idx = 0; section_idx < n_sections && nready == nthreads; section_idx++) {
-                        const size_t section_offset = section_idx * section_size;
-                        const size_t start          = section_offset + chunk_offset_start;
-                        const size_t stop           = section_offset + chunk_offset_stop;
-
-                        PRINT_DEBUG("%p chunk %u of section %u [%lu, %lu[\n",
-                                    (void*)&deflate_thread,
-                                    chunk_idx,
-                                    section_idx,
-                                    start * 8,
-                                    stop * 8);
-                        deflate_thread.set_end_block(stop * 8);
-
-                        consumer_wrapper.set_section_idx(section_idx);
-                        if (!deflate_thread.go(start * 8)) return;
-                        assert(chunk_idx != nthreads - 1 || stop == section_offset + section_size);
-                    }
-
-                    // No one will need the context from the last chunk of the last section
-                    if (chunk_idx == nthreads - 1)
-                        // Releasing it will enable the imediate destruction of the DeflateThread
-                        deflate_thread.get_context();
-                } catch (...) {
-                    std::unique_lock<std::mutex> lock{ready_mtx};
-                    if (!exception) {
-                        exception = std::current_exception();
-                        nready    = 0; // Stop the thread pool
-                    }
-                    return;
+/** Decodes chunks from the queue on one thread
+ * In pipelined mode, the worker keeps two random access chunks in flight: while the older one waits for its context or
+ * for its output turn, the next one is synced and decoded. The older chunk is resolved and output between the blocks of
+ * the newer one, as soon as it would not wait anymore.
+ * Before waiting for another chunk, the worker finds the first block of the next chunk ahead of time (see
+ * ChunkScheduler::reserve()).
+ * The decoders and their buffers are kept from one stream to the next.
+ */
+template<typename Consumer> class ChunkWorker
+{
+  public:
+    using job_t = DecompressJob<Consumer>;
+
+    /// Thrown when a previous chunk failed: the error is reported by the worker that decoded it
+    struct upstream_failed
+    {};
+
+    explicit ChunkWorker(bool pipelined)
+      : _pipelined(pipelined)
+    {}
+
+    ChunkWorker(const ChunkWorker&) = delete;
+    ChunkWorker& operator=(const ChunkWorker&) = delete;
+
+    /// Decode chunks until the queue is empty, the errors are reported to the job
+    void run(job_t& job)
+    {
+        _job     = &job;
+        _pending = nullptr;
+        if (_resolved) _resolved->bind(job);
+        if (_finder) _finder->set_input(job.in_stream);
+        for (auto& slot : _slots) {
+            if (slot) slot->bind(job);
+        }
+
+        try {
+            if (job.block_map != nullptr) job.block_map->scan(finder());
+
+            ChunkTask task;
+            while (job.scheduler.next(task)) {
+                if (task.upstream == nullptr || task.sequential) {
+                    decode_resolved(task);
+                } else {
+                    decode_random_access(task);
                 }
-            });
+            }
+            if (_pending != nullptr) finish(*_pending, nullptr);
+        } catch (const upstream_failed&) {
+            fail();
+        } catch (...) {
+            job.set_exception(std::current_exception());
+            fail();
+        }
+    }
+
+  private:
+    using clock = WaitClock::clock;
+
+    enum class stage_t { IDLE, DECODING, DECODED, RESOLVED };
+
+    /// The decoder of the first chunk, with a resolved context
+    struct resolved_t
+    {
+        explicit resolved_t(job_t& job)
+          : consumer_wrapper(job.consumer, job.sync)
+          , decoder(job.in_stream, consumer_wrapper)
+        {
+            decoder.set_litlen_tablebits(job.litlen_tablebits);
+        }
+
+        void bind(job_t& job)
+        {
+            consumer_wrapper.rebind(job.consumer, job.sync);
+            decoder.set_input(job.in_stream);
+            decoder.set_litlen_tablebits(job.litlen_tablebits);
+            task = {};
+        }
+
+        ConsumerWrapper<Consumer> consumer_wrapper;
+        DeflateThread             decoder;
+        ChunkTask                 task = {};
+    };
+
+    /// A random access decoder and the chunk it holds
+    struct slot_t
+    {
+        explicit slot_t(job_t& job)
+          : consumer_wrapper(job.consumer, job.sync)
+          , decoder(job.in_stream, consumer_wrapper)
+        {
+            decoder.set_litlen_tablebits(job.litlen_tablebits);
+        }
+
+        void bind(job_t& job)
+        {
+            consumer_wrapper.rebind(job.consumer, job.sync);
+            decoder.set_input(job.in_stream);
+            decoder.set_litlen_tablebits(job.litlen_tablebits);
+            stage = stage_t::IDLE;
+        }
+
+        ConsumerWrapper<Consumer> consumer_wrapper;
+        DeflateThreadRandomAccess decoder;
+        ChunkTask                 task  = {};
+        stage_t                   stage = stage_t::IDLE;
+        clock::duration           busy  = {}; // Time spent on the chunk, waits included
+    };
+
+    /// Unblock the chunks waiting for the contexts of the chunks in flight, and stop handing out chunks
+    void fail()
+    {
+        if (_resolved && _resolved->task.downstream != nullptr) _resolved->task.downstream->fail();
+        for (auto& slot : _slots) {
+            if (slot && slot->stage != stage_t::IDLE) slot->task.downstream->fail();
+        }
+        _job->scheduler.abort();
+    }
+
+    void decode_resolved(const ChunkTask& task)
+    {
+        // Decoders are created on first use: with several threads, the first chunk is the only one decoded with a
+        // resolved context
+        if (!_resolved) _resolved.reset(new resolved_t{*_job});
+        PRINT_DEBUG("%p decodes chunk %u\n", (void*)&_resolved->decoder, task.idx);
+
+        _resolved->task = task;
+        _resolved->consumer_wrapper.set_chunk_idx(task.idx, task.is_last);
+        _resolved->consumer_wrapper.count_lines(_job->scheduler.recording_index());
+        _resolved->consumer_wrapper.set_sketch(task.sketch);
+        const auto started = WaitClock::now();
+        _resolved->decoder.set_downstream(task.downstream);
+        if (task.upstream == nullptr) {
+            _resolved->decoder.set_initial_context();
+            _resolved->decoder.go(task.start * 8);
+        } else if (task.context != nullptr) {
+            _resolved->decoder.set_initial_context({task.context, ChunkIndex::context_size});
+            _resolved->decoder.go(task.synced_bitpos);
+        } else {
+            // The previous chunk is done: its context is posted, along with the position of the next block
+            auto context = task.upstream->get_context();
+            if (!context.first) throw upstream_failed{};
+            _resolved->decoder.set_initial_context({context.first.begin(), context.first.size()});
+            _resolved->decoder.go(context.second);
+        }
+        _job->scheduler.done(task,
+                             WaitClock::now() - started - _resolved->consumer_wrapper.wait_clock().take(),
+                             _resolved->consumer_wrapper.take_output_size(),
+                             _resolved->consumer_wrapper.take_output_lines());
+        _resolved->task = {};
+    }
+
+    void decode_random_access(const ChunkTask& task)
+    {
+        slot_t& slot = free_slot();
+        PRINT_DEBUG("%p decodes chunk %u\n", (void*)&slot.decoder, task.idx);
+
+        slot.task  = task;
+        slot.stage = stage_t::DECODING;
+        slot.busy  = {};
+        slot.consumer_wrapper.set_chunk_idx(task.idx, task.is_last);
+        slot.consumer_wrapper.count_lines(_job->scheduler.recording_index());
+        slot.consumer_wrapper.set_sketch(task.sketch);
+        slot.decoder.set_upstream(task.upstream);
+        slot.decoder.set_downstream(task.downstream);
+
+        const auto started        = WaitClock::now();
+        auto       between_blocks = [this]() {
+            if (_pending != nullptr && step(*_pending, false) && _pending->stage == stage_t::IDLE) _pending = nullptr;
+        };
+        _nested = {};
+        if (task.context != nullptr) {
+            span<const uint8_t> context = {task.context, ChunkIndex::context_size};
+            slot.decoder.decode_with_context(task.synced_bitpos, context, between_blocks);
+        } else {
+            slot.decoder.decode(task.start * 8, between_blocks, task.synced_bitpos);
+        }
+        slot.busy += WaitClock::now() - started - _nested;
+        slot.stage = stage_t::DECODED;
+
+        if (_pending != nullptr) finish(*_pending, &slot);
+        _pending = &slot;
+        if (!_pipelined) finish(slot, nullptr);
+    }
+
+    /// Resolve and output a decoded chunk, waiting for the previous chunks. Meanwhile, the context of the next
+    /// decoded chunk is posted if it is available.
+    void finish(slot_t& slot, slot_t* next)
+    {
+        if (slot.stage == stage_t::DECODED) step(slot, true);
+        if (next != nullptr) step(*next, false);
+        if (slot.stage == stage_t::RESOLVED) step(slot, true);
+        assert(slot.stage == stage_t::IDLE);
+        if (_pending == &slot) _pending = nullptr;
+    }
+
+    /// Bring a decoded chunk to its next stage, returns false if it would wait (and wait is false)
+    bool step(slot_t& slot, bool wait)
+    {
+        if (!ready(slot)) {
+            if (!wait) return false;
+            presync();
+        }
+
+        const auto started = WaitClock::now();
+        switch (slot.stage) {
+            case stage_t::DECODED:
+                if (!slot.decoder.resolve_context()) throw upstream_failed{};
+                slot.stage = stage_t::RESOLVED;
+                break;
+            case stage_t::RESOLVED:
+                slot.decoder.flush();
+                slot.stage = stage_t::IDLE;
+                break;
+            default: return false;
+        }
+        const auto elapsed = WaitClock::now() - started;
+        slot.busy += elapsed;
+        _nested += elapsed;
+
+        if (slot.stage == stage_t::IDLE)
+            _job->scheduler.done(slot.task,
+                                 slot.busy - slot.consumer_wrapper.wait_clock().take(),
+                                 slot.consumer_wrapper.take_output_size(),
+                                 slot.consumer_wrapper.take_output_lines());
+        return true;
+    }
+
+    /// Whether the next stage of a decoded chunk would not wait for other chunks
+    bool ready(slot_t& slot)
+    {
+        switch (slot.stage) {
+            case stage_t::DECODED: return slot.decoder.context_ready();
+            case stage_t::RESOLVED: return slot.consumer_wrapper.output_ready();
+            default: return true;
+        }
+    }
+
+    /// Rather than waiting, find the first block of the next chunk, and set where the previous chunk should stop
+    void presync()
+    {
+        ChunkTask task;
+        if (!_job->scheduler.reserve(task)) return;
+
+        size_t synced_bitpos = finder().find_block(task.start * 8);
+        if (synced_bitpos < task.stop * 8) {
+            PRINT_DEBUG("chunk %u presynced at %lu\n", task.idx, synced_bitpos);
+            task.upstream->set_end_block(synced_bitpos);
+        } else {
+            synced_bitpos = ChunkBoundary::unset_stop_pos; // Let the decoder report the error
         }
+        _job->scheduler.synced(task, synced_bitpos);
     }
 
-    for (auto& thread : threads)
-        thread.join();
+    DeflateParser& finder()
+    {
+        if (!_finder) _finder.reset(new DeflateParser{_job->in_stream});
+        return *_finder;
+    }
+
+    slot_t& free_slot()
+    {
+        auto& slot = _slots[_pending == _slots[0].get() ? 1 : 0];
+        if (!slot) slot.reset(new slot_t{*_job});
+        assert(slot->stage == stage_t::IDLE);
+        return *slot;
+    }
+
+    bool   _pipelined;
+    job_t* _job = nullptr;
+
+    std::unique_ptr<resolved_t>    _resolved = {};
+    std::unique_ptr<slot_t>        _slots[2] = {};
+    std::unique_ptr<DeflateParser> _finder   = {};      // Syncs the next chunks ahead of time, scans the block map
+    slot_t*                        _pending  = nullptr; // Decoded chunk waiting for its context or output turn
+    clock::duration                _nested   = {};      // Time spent on the pending chunk while decoding the next one
+};
+
+/// How streams are decompressed
+struct DecompressOptions
+{
+    // Auto mode: a thread is worth it for each 4MiB of compressed input (two random access chunks of minimal size)
+    static constexpr size_t auto_bytes_per_thread = 2 * ChunkScheduler::min_chunk_size;
+
+    unsigned nthreads         = 1;     /// Maximum number of threads
+    bool     auto_threads     = false; /// Choose the number of threads of each stream from its size (at most nthreads)
+    bool     pipelined        = true;  /// Each thread has two chunks in flight (twice the memory)
+    bool     pin_threads      = false; /// Pin threads to CPUs, filling NUMA nodes one after the other
+    bool     release_input    = false; /// Streams are file mappings: drop their pages once decompressed (frees RSS)
+    bool     prescan          = false; /// Map the blocks with all threads first, chunks then start at known blocks
+    bool     index_sketches   = false; /// Sketch the content of the chunks when building an index (see NgramSketch)
+    unsigned litlen_tablebits = 0;     /// Litlen main table bits of the decoders, chosen for each stream if 0
+
+    /// Number of threads decompressing a stream of in_size compressed bytes
+    unsigned threads_for(size_t in_size) const
+    {
+        const size_t bytes_per_thread = auto_threads ? auto_bytes_per_thread : size_t(2) << 20;
+        const size_t useful           = auto_threads ? in_size / bytes_per_thread : 1 + in_size / bytes_per_thread;
+        return unsigned(std::max(size_t(1), std::min(useful, size_t(nthreads))));
+    }
+};
+
+/** Decompression threads, reused from one gzip stream to the next
+ * The workers keep their decoders warm between streams: creating the threads and first touching their 512MiB buffers
+ * and mirrored windows dominates the decompression of small and mid-sized files.
+ * Streams are decompressed one at a time.
+ *
+ * A stream decoded by a single worker is a plain sequential decoding: no sync nor random access buffers (its chunks are
+ * decoded one after the other, each one from the context of the previous one). It runs on the calling thread, whatever
+ * the size of the pool.
+ *
+ * Threads can be pinned to CPUs, filling NUMA nodes one after the other (see topology::worker_cpus()). The decoders are
+ * created by their pinned thread on first use, so their buffers and windows are first touched, thus allocated, on its
+ * node. Small streams only wake the first workers, which share a node.
+ */
+template<typename Consumer> class DecompressorPool
+{
+  public:
+    explicit DecompressorPool(const DecompressOptions& options)
+      : _options(options)
+      , _inline_worker(false)
+      , _l1d_size(topology::data_cache_size(1))
+      , _l2_size(topology::data_cache_size(2))
+    {
+        if (_l1d_size == 0) _l1d_size = default_l1d_size;
+        if (_l2_size == 0) _l2_size = default_l2_size;
+
+        _options.nthreads = std::max(1u, _options.nthreads);
+        if (_options.nthreads == 1) return;
+
+        std::vector<unsigned> cpus;
+        if (_options.pin_threads) cpus = topology::worker_cpus(_options.nthreads);
+
+        _threads.reserve(_options.nthreads);
+        for (unsigned thread_idx = 0; thread_idx < _options.nthreads; thread_idx++) {
+            const int cpu = thread_idx < cpus.size() ? int(cpus[thread_idx]) : -1;
+            _threads.emplace_back([this, thread_idx, cpu]() { worker_main(thread_idx, cpu); });
+        }
+    }
+
+    DecompressorPool(const DecompressorPool&) = delete;
+    DecompressorPool& operator=(const DecompressorPool&) = delete;
+
+    ~DecompressorPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock{_mut};
+            _stopping = true;
+            _job_cond.notify_all();
+        }
+        for (auto& thread : _threads)
+            thread.join();
+    }
+
+    const DecompressOptions& options() const { return _options; }
+
+    /** Decompress a gzip stream, the consumer gets the output in order if sync is not null.
+     * The chunks of index are used if it matches the stream, otherwise they are added to build_index (if not null).
+     */
+    void decompress(const byte*       in,
+                    size_t            in_nbytes,
+                    Consumer&         consumer,
+                    ConsumerSync*     sync,
+                    const ChunkIndex* index       = nullptr,
+                    ChunkIndex*       build_index = nullptr)
+    {
+        // FIXME: handle header parsing inside DeflateThread*, allowing multimember gzip files
+        InputStream in_stream2(in, in_nbytes);
+        in_stream2.consume_header();
+        InputStream in_stream(in_stream2.in_next, in_stream2.available());
+        unsigned    nthreads = _options.threads_for(in_stream2.available());
+
+        if (index != nullptr && !index->matches(in, in_nbytes)) index = nullptr;
+        if (index != nullptr) build_index = nullptr;
+
+        PRINT_DEBUG("Using %u threads\n", nthreads);
+
+        std::lock_guard<std::mutex> job_lock{_job_mut};
+        std::unique_ptr<BlockMap>   block_map;
+        if (_options.prescan && nthreads > 1 && index == nullptr) block_map.reset(new BlockMap{in_stream.size()});
+        ChunkThroughput         throughput;
+        ChunkScheduler          scheduler{
+          in_stream, _options.release_input ? in : nullptr, nthreads, throughput, block_map.get()};
+        DecompressJob<Consumer> job{in_stream, consumer, sync, scheduler, block_map.get()};
+        if (index != nullptr) scheduler.use_index(*index);
+        if (build_index != nullptr) scheduler.record_index(_options.index_sketches);
+        job.litlen_tablebits
+          = _options.litlen_tablebits != 0 ? _options.litlen_tablebits : litlen_tablebits(in_stream);
+
+        if (nthreads == 1) {
+            _inline_worker.run(job);
+        } else {
+            std::unique_lock<std::mutex> lock{_mut};
+            _job      = &job;
+            _nworkers = nthreads;
+            _running  = nthreads;
+            _generation++;
+            _job_cond.notify_all();
+            while (_running != 0)
+                _done_cond.wait(lock);
+            _job = nullptr;
+        }
+
+        if (job.exception) { std::rethrow_exception(job.exception); }
+        if (build_index != nullptr) {
+            *build_index = ChunkIndex{in, in_nbytes};
+            scheduler.fill_index(*build_index);
+        }
+    }
+
+  private:
+    /// Cache sizes assumed when they can't be detected
+    static constexpr size_t default_l1d_size = size_t(32) << 10;
+    static constexpr size_t default_l2_size  = size_t(256) << 10;
+
+    /// Litlen table bits for a stream, from a few of its blocks
+    unsigned litlen_tablebits(const InputStream& in_stream)
+    {
+        if (_sampler) {
+            _sampler->set_input(in_stream);
+        } else {
+            _sampler.reset(new DeflateParser{in_stream});
+        }
+        return _sampler->choose_litlen_tablebits(_l1d_size, _l2_size);
+    }
+
+    void worker_main(unsigned thread_idx, int cpu)
+    {
+        // Before anything is allocated by the worker
+        if (cpu >= 0 && !topology::pin_thread(unsigned(cpu))) PRINT_DEBUG("failed to pin thread %u\n", thread_idx);
+
+        ChunkWorker<Consumer>        worker{_options.pipelined};
+        uint64_t                     generation = 0;
+        std::unique_lock<std::mutex> lock{_mut};
+        for (;;) {
+            while (!_stopping && (_generation == generation || thread_idx >= _nworkers))
+                _job_cond.wait(lock);
+            if (_stopping) return;
+            generation = _generation;
+
+            DecompressJob<Consumer>& job = *_job;
+            lock.unlock();
+            worker.run(job);
+            lock.lock();
+
+            if (--_running == 0) _done_cond.notify_all();
+        }
+    }
+
+    DecompressOptions              _options;
+    ChunkWorker<Consumer>          _inline_worker; // Runs the streams decompressed by a single thread
+    size_t                         _l1d_size;      // Cache sizes, the litlen tables of each stream are chosen to fit
+    size_t                         _l2_size;
+    std::unique_ptr<DeflateParser> _sampler = {};  // Samples a few blocks of each stream for its litlen tables
+    std::mutex                     _job_mut{};     // Held while a stream is decompressed
+    std::mutex                     _mut{};
+    std::condition_variable        _job_cond{};
+    std::condition_variable        _done_cond{};
+    DecompressJob<Consumer>*       _job        = nullptr;
+    uint64_t                       _generation = 0;     // Incremented for each job
+    unsigned                       _nworkers   = 0;     // Number of threads working on the current job
+    unsigned                       _running    = 0;     // Number of threads still working on the current job
+    bool                           _stopping   = false; // Threads should exit
+    std::vector<std::thread>       _threads{};
+};
+
+/// Decompress a gzip stream with a pool of nthreads created for the occasion (see DecompressorPool)
+template<typename Consumer>
+static enum libdeflate_result
+libdeflate_gzip_decompress(const byte*   in,
+                           size_t        in_nbytes,
+                           unsigned      nthreads,
+                           Consumer&     consumer,
+                           ConsumerSync* sync,
+                           bool          pipelined = true)
+{
+    DecompressOptions options;
+    options.pipelined = pipelined;
 
-    if (exception) { std::rethrow_exception(exception); }
+    // Skip the header to count the threads that will actually work
+    InputStream in_stream(in, in_nbytes);
+    in_stream.consume_header();
+    options.nthreads = nthreads;
+    options.nthreads = options.threads_for(in_stream.available());
 
+    DecompressorPool<Consumer> pool{options};
+    pool.decompress(in, in_nbytes, consumer, sync);
     return LIBDEFLATE_SUCCESS;
 }
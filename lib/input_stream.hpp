@@ -239,7 +239,8 @@ class InputStream
         memcpy(&bitbuf, in_next, sizeof(bitbuf_t));
         in_next += +sizeof(bitbuf_t);
         bitbuf >>= pos_bits;
-        bitsleft = bitbuf_length - pos_bits;
+        bitsleft      = bitbuf_length - pos_bits;
+        overrun_count = 0; // Whatever a previous (trial) decoding read past the end
 
         assert(position_bits() == bit_pos);
         return true;
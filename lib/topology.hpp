@@ -0,0 +1,219 @@
+#ifndef TOPOLOGY_HPP
+#define TOPOLOGY_HPP
+
+#include <cstdio>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "assert.hpp"
+
+namespace topology {
+
+/// Parse a sysfs cpu list (eg. "0-5,12-17"), returns an empty list if the file can't be read
+inline std::vector<unsigned>
+read_cpulist(const std::string& path)
+{
+    std::vector<unsigned> cpus;
+    FILE*                 f = fopen(path.c_str(), "r");
+    if (f == nullptr) return cpus;
+
+    unsigned first, last;
+    char     sep;
+    while (fscanf(f, "%u", &first) == 1) {
+        last = first;
+        sep  = char(fgetc(f));
+        if (sep == '-') {
+            if (fscanf(f, "%u", &last) != 1) break;
+            sep = char(fgetc(f));
+        }
+        for (unsigned cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+        if (sep != ',') break;
+    }
+    fclose(f);
+    return cpus;
+}
+
+/// The CPUs the process is allowed to run on, grouped by NUMA node (a single group without NUMA information)
+inline std::vector<std::vector<unsigned>>
+allowed_cpus_by_node()
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return {};
+
+    std::vector<std::vector<unsigned>> nodes;
+    std::vector<unsigned>              node_less;
+    for (unsigned node : read_cpulist("/sys/devices/system/node/online")) {
+        std::vector<unsigned> cpus;
+        for (unsigned cpu : read_cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist")) {
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+                CPU_CLR(cpu, &allowed);
+            }
+        }
+        if (!cpus.empty()) nodes.push_back(std::move(cpus));
+    }
+
+    // CPUs not listed in any node (no NUMA support)
+    for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) node_less.push_back(cpu);
+    }
+    if (!node_less.empty()) nodes.push_back(std::move(node_less));
+    return nodes;
+}
+
+/** The CPUs where to pin nthreads workers
+ * Nodes are filled one after the other, so that workers with close indices share a node, and that a few workers don't
+ * spread over all nodes. Wraps around when there are more workers than CPUs.
+ */
+inline std::vector<unsigned>
+worker_cpus(unsigned nthreads)
+{
+    std::vector<unsigned> node_major;
+    for (const auto& node : allowed_cpus_by_node())
+        node_major.insert(node_major.end(), node.begin(), node.end());
+
+    std::vector<unsigned> cpus;
+    if (node_major.empty()) return cpus;
+    for (unsigned thread_idx = 0; thread_idx < nthreads; thread_idx++)
+        cpus.push_back(node_major[thread_idx % node_major.size()]);
+    return cpus;
+}
+
+/// CPU bandwidth allowed by a cgroup v2 cpu.max or cgroup v1 cfs quota file pair, in CPUs (0 if unlimited)
+inline unsigned
+read_cpu_quota(const std::string& quota_path, const std::string& period_path = {})
+{
+    FILE* f = fopen(quota_path.c_str(), "r");
+    if (f == nullptr) return 0;
+    long quota = -1, period = 0;
+    int  n     = fscanf(f, "%ld %ld", &quota, &period); // "max 100000" doesn't parse: unlimited
+    fclose(f);
+    if (n < 1 || quota <= 0) return 0;
+
+    if (!period_path.empty()) {
+        f = fopen(period_path.c_str(), "r");
+        if (f == nullptr) return 0;
+        n = fscanf(f, "%ld", &period);
+        fclose(f);
+        if (n != 1) return 0;
+    }
+    if (period <= 0) return 0;
+    return unsigned(std::max(1L, (quota + period - 1) / period));
+}
+
+/// CPU quota of the cgroups of the process, in CPUs (0 if unlimited)
+inline unsigned
+cgroup_cpu_quota()
+{
+    unsigned quota = 0;
+    auto     limit = [&](unsigned q) {
+        if (q != 0 && (quota == 0 || q < quota)) quota = q;
+    };
+
+    FILE* f = fopen("/proc/self/cgroup", "r");
+    if (f == nullptr) return 0;
+    char line[4096];
+    while (fgets(line, sizeof(line), f) != nullptr) {
+        std::string entry{line};
+        if (!entry.empty() && entry.back() == '\n') entry.pop_back();
+        const size_t controllers_start = entry.find(':');
+        const size_t path_start        = entry.find(':', controllers_start + 1);
+        if (controllers_start == std::string::npos || path_start == std::string::npos) continue;
+        const std::string controllers = entry.substr(controllers_start + 1, path_start - controllers_start - 1);
+        std::string       path        = entry.substr(path_start + 1);
+
+        // The quota of parent cgroups applies too
+        for (;;) {
+            if (controllers.empty()) { // cgroup v2
+                limit(read_cpu_quota("/sys/fs/cgroup" + path + "/cpu.max"));
+            } else if (("," + controllers + ",").find(",cpu,") != std::string::npos) { // cgroup v1
+                for (const char* mount : {"/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct"})
+                    limit(read_cpu_quota(mount + path + "/cpu.cfs_quota_us", mount + path + "/cpu.cfs_period_us"));
+            }
+            if (path.empty() || path == "/") break;
+            path.erase(path.rfind('/'));
+        }
+    }
+    fclose(f);
+    return quota;
+}
+
+/// Number of CPUs the process can keep busy: online CPUs, restricted by the affinity mask and the cgroup quota
+inline unsigned
+available_cpus()
+{
+    long     online = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned cpus   = online > 0 ? unsigned(online) : 1;
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) cpus = std::min(cpus, unsigned(CPU_COUNT(&allowed)));
+
+    const unsigned quota = cgroup_cpu_quota();
+    if (quota != 0) cpus = std::min(cpus, quota);
+    return std::max(1u, cpus);
+}
+
+/// Size in bytes of the data (or unified) cache of the given level seen by the first CPU, 0 if unknown
+inline size_t
+data_cache_size(unsigned level)
+{
+    for (unsigned index = 0;; index++) {
+        const std::string dir = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/";
+        FILE*             f   = fopen((dir + "level").c_str(), "r");
+        if (f == nullptr) break;
+        unsigned cache_level = 0;
+        int      n           = fscanf(f, "%u", &cache_level);
+        fclose(f);
+        if (n != 1 || cache_level != level) continue;
+
+        char type[32] = {};
+        f             = fopen((dir + "type").c_str(), "r");
+        if (f == nullptr) continue;
+        n = fscanf(f, "%31s", type);
+        fclose(f);
+        if (n != 1 || std::string{type} == "Instruction") continue;
+
+        size_t size = 0;
+        char   unit = 'K';
+        f           = fopen((dir + "size").c_str(), "r");
+        if (f == nullptr) continue;
+        n = fscanf(f, "%zu%c", &size, &unit);
+        fclose(f);
+        if (n < 1) continue;
+        if (unit == 'K') size <<= 10;
+        if (unit == 'M') size <<= 20;
+        return size;
+    }
+
+#if defined(_SC_LEVEL1_DCACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE)
+    if (level == 1 || level == 2) { // No sysfs cache information, glibc may know better
+        const long size = sysconf(level == 1 ? _SC_LEVEL1_DCACHE_SIZE : _SC_LEVEL2_CACHE_SIZE);
+        if (size > 0) return size_t(size);
+    }
+#endif
+    return 0;
+}
+
+/// Pin the calling thread to a CPU, returns false on failure
+inline bool
+pin_thread(unsigned cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    PRINT_DEBUG("pinned thread to cpu %u: %d\n", cpu, ret);
+    return ret == 0;
+}
+
+} // namespace topology
+
+#endif // TOPOLOGY_HPP
@@ -0,0 +1,294 @@
+#ifndef TRANSLATE_HPP
+#define TRANSLATE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+#include "memory.hpp"
+#include "assert.hpp"
+
+/** Translation of the symbols of a chunk decoded before its context was known (see BackrefMultiplexer)
+ * Symbols below a passthrough value are characters (the lookup table maps them to themselves), the others are
+ * back-references to the initial context, translated through the lookup table. The kernels are chosen at runtime from
+ * the instruction sets of the CPU, the blocks of characters only are narrowed or left in place without lookups.
+ */
+namespace translate {
+
+/// 8bits symbols translated in place through a 256 entries lookup table
+using narrow_kernel_t = void (*)(uint8_t* data, size_t n, const uint8_t* lkt, unsigned passthrough);
+/// 16bits symbols translated to out, which may alias in (the output is written behind the input)
+using wide_kernel_t = void (*)(const uint16_t* in, size_t n, uint8_t* out, const uint8_t* lkt, unsigned passthrough);
+/// Occurrences of the 8bits symbols the 256 entries lookup table translates to c
+using count_kernel_t = size_t (*)(const uint8_t* data, size_t n, const uint8_t* lkt, uint8_t c);
+
+inline void
+narrow_scalar(uint8_t* data, size_t n, const uint8_t* lkt, unsigned)
+{
+    for (size_t i = 0; i < n; i++)
+        data[i] = lkt[data[i]];
+}
+
+inline void
+wide_scalar(const uint16_t* in, size_t n, uint8_t* out, const uint8_t* lkt, unsigned)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = lkt[in[i]];
+}
+
+inline size_t
+count_scalar(const uint8_t* data, size_t n, const uint8_t* lkt, uint8_t c)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++)
+        count += lkt[data[i]] == c;
+    return count;
+}
+
+/// pshufb lookups in the 16 entries rows of the table, selected by the high nibble of the symbols
+__attribute__((target("avx2"))) inline void
+narrow_avx2(uint8_t* data, size_t n, const uint8_t* lkt, unsigned passthrough)
+{
+    const unsigned first_row = passthrough / 16; // The rows before only hold characters
+    __m256i        rows[16];
+    for (unsigned row = first_row; row < 16; row++)
+        rows[row] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lkt + 16 * row)));
+
+    const __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+    const __m256i last_char   = _mm256_set1_epi8(char(passthrough - 1));
+    size_t        i           = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i syms  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        const __m256i chars = _mm256_cmpeq_epi8(_mm256_max_epu8(syms, last_char), last_char);
+        if (_mm256_movemask_epi8(chars) == -1) continue;
+
+        const __m256i low  = _mm256_and_si256(syms, nibble_mask);
+        const __m256i high = _mm256_and_si256(_mm256_srli_epi16(syms, 4), nibble_mask);
+        __m256i       res  = syms;
+        for (unsigned row = first_row; row < 16; row++) {
+            const __m256i in_row = _mm256_cmpeq_epi8(high, _mm256_set1_epi8(char(row)));
+            res                  = _mm256_blendv_epi8(res, _mm256_shuffle_epi8(rows[row], low), in_row);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), res);
+    }
+    narrow_scalar(data + i, n - i, lkt, passthrough);
+}
+
+/// vpermi2b lookups in both halves of the table, selected by the high bit of the symbols
+__attribute__((target("avx512f,avx512bw,avx512vbmi"))) inline void
+narrow_avx512vbmi(uint8_t* data, size_t n, const uint8_t* lkt, unsigned passthrough)
+{
+    const __m512i quarter0  = _mm512_loadu_si512(lkt);
+    const __m512i quarter1  = _mm512_loadu_si512(lkt + 64);
+    const __m512i quarter2  = _mm512_loadu_si512(lkt + 128);
+    const __m512i quarter3  = _mm512_loadu_si512(lkt + 192);
+    const __m512i last_char = _mm512_set1_epi8(char(passthrough - 1));
+    size_t        i         = 0;
+    for (; i + 64 <= n; i += 64) {
+        const __m512i   syms    = _mm512_loadu_si512(data + i);
+        const __mmask64 backref = _mm512_cmpgt_epu8_mask(syms, last_char);
+        if (backref == 0) continue;
+
+        const __m512i low  = _mm512_permutex2var_epi8(quarter0, syms, quarter1);
+        const __m512i high = _mm512_permutex2var_epi8(quarter2, syms, quarter3);
+        _mm512_mask_storeu_epi8(data + i, backref, _mm512_mask_blend_epi8(_mm512_movepi8_mask(syms), low, high));
+    }
+    narrow_scalar(data + i, n - i, lkt, passthrough);
+}
+
+/// Narrows blocks of 32 symbols, then looks up the back-references of the block one by one
+__attribute__((target("avx2,bmi"))) inline void
+wide_avx2(const uint16_t* in, size_t n, uint8_t* out, const uint8_t* lkt, unsigned passthrough)
+{
+    const __m256i last_char = _mm256_set1_epi16(short(passthrough - 1));
+    size_t        i         = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i syms0  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        const __m256i syms1  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 16));
+        const __m256i chars0 = _mm256_cmpeq_epi16(_mm256_max_epu16(syms0, last_char), last_char);
+        const __m256i chars1 = _mm256_cmpeq_epi16(_mm256_max_epu16(syms1, last_char), last_char);
+        // The packs interleave the 128bits lanes of their operands
+        const __m256i narrowed = _mm256_permute4x64_epi64(_mm256_packus_epi16(syms0, syms1), 0xD8);
+        uint32_t      backrefs
+          = ~uint32_t(_mm256_movemask_epi8(_mm256_permute4x64_epi64(_mm256_packs_epi16(chars0, chars1), 0xD8)));
+        if (backrefs == 0) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), narrowed);
+            continue;
+        }
+
+        // From copies: out may overwrite the symbols of the block
+        alignas(32) uint16_t syms[32];
+        alignas(32) uint8_t  chars[32];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(syms), syms0);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(syms + 16), syms1);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(chars), narrowed);
+        for (; backrefs != 0; backrefs = _blsr_u32(backrefs)) {
+            const unsigned j = unsigned(__builtin_ctz(backrefs));
+            chars[j]         = lkt[syms[j]];
+        }
+        memcpy(out + i, chars, sizeof(chars));
+    }
+    wide_scalar(in + i, n - i, out + i, lkt, passthrough);
+}
+
+/// Narrows blocks of 64 symbols, then looks up the back-references of the block one by one
+__attribute__((target("avx512f,avx512bw,bmi"))) inline void
+wide_avx512bw(const uint16_t* in, size_t n, uint8_t* out, const uint8_t* lkt, unsigned passthrough)
+{
+    const __m512i last_char = _mm512_set1_epi16(short(passthrough - 1));
+    size_t        i         = 0;
+    for (; i + 64 <= n; i += 64) {
+        const __m512i syms0     = _mm512_loadu_si512(in + i);
+        const __m512i syms1     = _mm512_loadu_si512(in + i + 32);
+        const __m256i narrowed0 = _mm512_maskz_cvtepi16_epi8(__mmask32(-1), syms0);
+        const __m256i narrowed1 = _mm512_maskz_cvtepi16_epi8(__mmask32(-1), syms1);
+        uint64_t      backrefs  = uint64_t(_mm512_cmpgt_epu16_mask(syms0, last_char))
+                            | uint64_t(_mm512_cmpgt_epu16_mask(syms1, last_char)) << 32;
+        if (backrefs == 0) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), narrowed0);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 32), narrowed1);
+            continue;
+        }
+
+        // From copies: out may overwrite the symbols of the block
+        alignas(64) uint16_t syms[64];
+        alignas(64) uint8_t  chars[64];
+        _mm512_store_si512(syms, syms0);
+        _mm512_store_si512(syms + 32, syms1);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(chars), narrowed0);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(chars + 32), narrowed1);
+        for (; backrefs != 0; backrefs = _blsr_u64(backrefs)) {
+            const unsigned j = unsigned(__builtin_ctzll(backrefs));
+            chars[j]         = lkt[syms[j]];
+        }
+        memcpy(out + i, chars, sizeof(chars));
+    }
+    wide_scalar(in + i, n - i, out + i, lkt, passthrough);
+}
+
+/** Membership test in the set of symbols translating to c, as a bitmap of the rows (high nibbles) holding c for each
+ * column (low nibble): one bitmap per half of the table, selected by the high bit of the symbols
+ */
+__attribute__((target("avx2,popcnt"))) inline size_t
+count_avx2(const uint8_t* data, size_t n, const uint8_t* lkt, uint8_t c)
+{
+    alignas(16) uint8_t columns[2][16] = {};
+    for (unsigned sym = 0; sym < 256; sym++) {
+        if (lkt[sym] == c) columns[sym / 128][sym % 16] |= uint8_t(1u << (sym / 16 % 8));
+    }
+    const __m256i columns_low  = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<__m128i*>(columns[0])));
+    const __m256i columns_high = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<__m128i*>(columns[1])));
+    const __m256i row_bits
+      = _mm256_broadcastsi128_si256(_mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128));
+    const __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+
+    size_t count = 0, i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i syms = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        const __m256i low  = _mm256_and_si256(syms, nibble_mask);
+        const __m256i row  = _mm256_shuffle_epi8(row_bits, _mm256_and_si256(_mm256_srli_epi16(syms, 4), nibble_mask));
+        const __m256i rows = _mm256_blendv_epi8(
+          _mm256_shuffle_epi8(columns_low, low), _mm256_shuffle_epi8(columns_high, low), syms);
+        const __m256i hits = _mm256_cmpeq_epi8(_mm256_and_si256(rows, row), row);
+        count += unsigned(_mm_popcnt_u32(uint32_t(_mm256_movemask_epi8(hits))));
+    }
+    return count + count_scalar(data + i, n - i, lkt, c);
+}
+
+struct kernels_t
+{
+    narrow_kernel_t narrow;
+    wide_kernel_t   wide;
+    count_kernel_t  count;
+    const char*     name;
+};
+
+/// The fastest kernels supported by the CPU, chosen on first use
+inline const kernels_t&
+kernels()
+{
+    static const kernels_t selected = []() -> kernels_t {
+        __builtin_cpu_init();
+        kernels_t best = {narrow_scalar, wide_scalar, count_scalar, "scalar"};
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("popcnt"))
+            best = {narrow_avx2, wide_avx2, count_avx2, "avx2"};
+        if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("bmi")) {
+            best.wide = wide_avx512bw;
+            best.name = "avx512bw";
+        }
+        if (__builtin_cpu_supports("avx512vbmi") && __builtin_cpu_supports("bmi")) {
+            best.narrow = narrow_avx512vbmi;
+            best.name   = "avx512vbmi";
+        }
+        PRINT_DEBUG("translation kernels: %s\n", best.name);
+        return best;
+    }();
+    return selected;
+}
+
+/// Translate 8bits symbols in place, lkt holds 256 entries and maps the symbols below passthrough to themselves
+inline void
+narrow(span<uint8_t> data, span<const uint8_t> lkt, unsigned passthrough)
+{
+    assert(lkt.size() == 256 && passthrough > 0 && passthrough <= 256);
+    kernels().narrow(data.begin(), data.size(), lkt.begin(), passthrough);
+}
+
+/// Translate 16bits symbols to out (which may be the start of in), lkt maps the symbols below passthrough to themselves
+inline void
+wide(span<const uint16_t> in, uint8_t* out, span<const uint8_t> lkt, unsigned passthrough)
+{
+    assert(passthrough > 0 && passthrough <= lkt.size() && passthrough <= 256);
+    kernels().wide(in.begin(), in.size(), out, lkt.begin(), passthrough);
+}
+
+/// Occurrences of the 8bits symbols translating to c, without translating them (lkt holds 256 entries)
+inline size_t
+count(span<const uint8_t> data, span<const uint8_t> lkt, uint8_t c)
+{
+    assert(lkt.size() == 256);
+    return kernels().count(data.begin(), data.size(), lkt.begin(), c);
+}
+
+/// Adds the occurrences of each 16bits symbol to hist (an entry per symbol), to compose with the lookup table rather
+/// than translating the symbols
+inline void
+histogram(span<const uint16_t> data, uint32_t* hist)
+{
+    for (uint16_t sym : data)
+        hist[sym]++;
+}
+
+/// Same as histogram() for 8bits symbols (256 entries), with interleaved sub-histograms so that runs of a symbol don't
+/// wait on the increments of a single counter
+inline void
+histogram(span<const uint8_t> data, uint32_t* hist)
+{
+    uint32_t       sub[4][256] = {};
+    const uint8_t* p           = data.begin();
+    size_t         i           = 0;
+    for (; i + 4 <= data.size(); i += 4) {
+        sub[0][p[i]]++;
+        sub[1][p[i + 1]]++;
+        sub[2][p[i + 2]]++;
+        sub[3][p[i + 3]]++;
+    }
+    for (; i < data.size(); i++)
+        sub[0][p[i]]++;
+    for (unsigned sym = 0; sym < 256; sym++)
+        hist[sym] += sub[0][sym] + sub[1][sym] + sub[2][sym] + sub[3][sym];
+}
+
+/// Composes 16bits symbols with the context they refer to: the characters are kept, the back-references are replaced by
+/// the entry of base (symbols or characters) at their offset
+template<typename T>
+inline void
+compose(span<const uint16_t> symbols, const T* base, T* out, unsigned passthrough)
+{
+    for (size_t i = 0; i < symbols.size(); i++)
+        out[i] = symbols[i] < passthrough ? T(symbols[i]) : base[symbols[i] - passthrough];
+}
+
+} // namespace translate
+
+#endif // TRANSLATE_HPP
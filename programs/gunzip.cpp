@@ -39,22 +39,39 @@
 
 struct options
 {
-    bool     count_lines;
-    unsigned nthreads;
+    bool              count_lines = false;
+    bool              count_bytes = false;
+    bool              use_index   = false; // Use FILE.pugzi, build it if missing or stale
+    bool              index_only  = false; // Only build FILE.pugzi
+    size_t            first_line  = 0;       // Lines to extract (numbered from 1) with FILE.pugzi, if not 0
+    size_t            last_line   = 0;
+    const char*       pattern     = nullptr; // Search the lines holding it with FILE.pugzi and its sketches
+    DecompressOptions decompress  = {};
 };
 
-static const tchar* const optstring = T(":hnlt:V");
+static const tchar* const optstring = T(":bg:hHiIL:nlpst:V");
 
 static void
 show_usage(FILE* fp)
 {
     fprintf(fp,
-            "Usage: %" TS " [-l] [-t n] FILE...\n"
+            "Usage: %" TS " [-b] [-i|-I|-L from:to|-g pattern] [-l|-H] [-p] [-s] [-t n|auto] FILE...\n"
             "Decompress the specified FILEs.\n"
             "\n"
             "Options:\n"
+            "  -b        find the block boundaries with all threads first, then decompress balanced chunks\n"
+            "  -i        decompress the chunks indexed in FILE.pugzi, or index FILE there while decompressing it\n"
+            "  -I        only index FILE to FILE.pugzi, without output\n"
+            "  -L m:n    output the lines m to n like sed -n m,np (from 1, to the end with m:, only line m if n < m)\n"
+            "            from FILE.pugzi, built if missing\n"
             "  -l        count line instead of content to standard output\n"
+            "  -H        output the number of occurrences of each byte value instead of content\n"
+            "  -p        pin threads to CPUs, filling NUMA nodes one after the other\n"
+            "  -s        decode one chunk at a time per thread (no pipelining, less memory)\n"
             "  -t n      use n threads\n"
+            "  -t auto   choose the number of threads from the file size and the available CPUs\n"
+            "  -g str    output the lines holding str, only decompressing the chunks whose sketch in FILE.pugzi\n"
+            "            may hold it (FILE.pugzi is built with sketches if needed)\n"
             "  -h        print this help\n"
             "  -V        show version and legal information\n",
             program_invocation_name);
@@ -98,8 +115,9 @@ stat_file(struct file_stream* in, stat_t* stbuf, bool allow_hard_links)
     return 0;
 }
 
+template<typename Consumer>
 static int
-decompress_file(const tchar* path, const struct options* options)
+decompress_file(const tchar* path, DecompressorPool<Consumer>& pool, const struct options* options, bool ordered)
 {
     struct file_stream in;
     stat_t             stbuf;
@@ -117,13 +135,21 @@ decompress_file(const tchar* path, const struct options* options)
     if (ret != 0) goto out_close_in;
 
     in_p = static_cast<const byte*>(in.mmap_mem);
-    if (options->count_lines) {
-        LineCounter line_counter{};
-        libdeflate_gzip_decompress(in_p, in.mmap_size, options->nthreads, line_counter, nullptr);
-    } else {
-        OutputConsumer output{};
-        ConsumerSync   sync{};
-        libdeflate_gzip_decompress(in_p, in.mmap_size, options->nthreads, output, &sync);
+    {
+        Consumer     consumer{};
+        ConsumerSync sync{};
+        if ((options->use_index || options->index_only) && path != nullptr) {
+            const std::string index_path = std::string(path) + ".pugzi";
+            ChunkIndex        index;
+            const bool        indexed = !options->index_only && index.read(index_path.c_str())
+                                 && index.matches(in_p, in.mmap_size);
+            ChunkIndex        built;
+            pool.decompress(
+              in_p, in.mmap_size, consumer, ordered ? &sync : nullptr, &index, indexed ? nullptr : &built);
+            if (!indexed) built.write(index_path.c_str());
+        } else {
+            pool.decompress(in_p, in.mmap_size, consumer, ordered ? &sync : nullptr);
+        }
     }
 
     ret = 0;
@@ -134,6 +160,81 @@ out_free_paths:
     return ret;
 }
 
+/* Output a range of lines or search lines, from the chunks of the index of the file (built first if missing, stale or
+ * without sketches for a search) */
+static int
+extract_indexed(const tchar* path, const struct options* options)
+{
+    struct file_stream in;
+    stat_t             stbuf;
+    int                ret;
+    const byte*        in_p;
+    ChunkIndex         index;
+    const std::string  index_path = std::string(path != nullptr ? path : "") + ".pugzi";
+
+    if (path == nullptr) {
+        msg("-L and -g need a FILE to index");
+        return -1;
+    }
+
+    ret = xopen_for_read(path, true, &in);
+    if (ret != 0) return ret;
+
+    ret = stat_file(&in, &stbuf, true);
+    if (ret != 0) goto out_close_in;
+
+    ret = map_file_contents(&in, size_t(stbuf.st_size));
+    if (ret != 0) goto out_close_in;
+
+    in_p = static_cast<const byte*>(in.mmap_mem);
+    if (!index.read(index_path.c_str()) || !index.matches(in_p, in.mmap_size)
+        || (options->pattern != nullptr && !index.has_sketches())) {
+        // Built as with -I
+        struct options indexing            = *options;
+        indexing.index_only                = true;
+        indexing.decompress.index_sketches = options->pattern != nullptr;
+        {
+            DecompressorPool<DiscardConsumer> pool{indexing.decompress};
+            ret = decompress_file(path, pool, &indexing, false);
+        }
+        if (ret != 0) goto out_close_in;
+        if (!index.read(index_path.c_str())) {
+            ret = -1;
+            goto out_close_in;
+        }
+    }
+    {
+        pugz::Extractor extractor{in_p, in.mmap_size, index, options->decompress.nthreads};
+        OutputConsumer  consumer{};
+        if (options->pattern != nullptr) {
+            const auto* pattern = reinterpret_cast<const uint8_t*>(options->pattern);
+            extractor.grep({pattern, strlen(options->pattern)}, consumer);
+        } else {
+            extractor.extract_lines(options->first_line - 1, options->last_line - options->first_line + 1, consumer);
+        }
+    }
+
+    ret = 0;
+
+out_close_in:
+    xclose(&in);
+    return ret;
+}
+
+/* The decompression threads and their buffers are reused from one file to the next */
+template<typename Consumer>
+static int
+decompress_files(tchar* paths[], int npaths, const struct options* options, bool ordered)
+{
+    DecompressorPool<Consumer> pool{options->decompress};
+    int                        ret = 0;
+
+    for (int i = 0; i < npaths; i++) {
+        ret |= -decompress_file(paths[i], pool, options, ordered);
+    }
+    return ret;
+}
+
 int
 tmain(int argc, tchar* argv[])
 {
@@ -145,12 +246,35 @@ tmain(int argc, tchar* argv[])
 
     program_invocation_name = get_filename(argv[0]);
 
-    options.count_lines = false;
-    options.nthreads    = 1;
+    options.count_lines              = false;
+    options.decompress.release_input = true; // Each file is mapped, and decompressed once
 
     while ((opt_char = tgetopt(argc, argv, optstring)) != -1) {
         switch (opt_char) {
+            case 'b': options.decompress.prescan = true; break;
+            case 'g': options.pattern = toptarg; break;
+            case 'i': options.use_index = true; break;
+            case 'I': options.index_only = true; break;
+            case 'L': {
+                tchar* end         = nullptr;
+                options.first_line = size_t(tstrtoull(toptarg, &end, 10));
+                options.last_line  = options.first_line;
+                if (*end == ':') {
+                    end++;
+                    options.last_line = *end == '\0' ? SIZE_MAX : size_t(tstrtoull(end, &end, 10));
+                }
+                if (*end != '\0' || options.first_line == 0) {
+                    show_usage(stderr);
+                    return 1;
+                }
+                // Like sed, a range ending before it starts is its first line
+                options.last_line = std::max(options.last_line, options.first_line);
+                break;
+            }
             case 'l': options.count_lines = true; break;
+            case 'H': options.count_bytes = true; break;
+            case 'p': options.decompress.pin_threads = true; break;
+            case 's': options.decompress.pipelined = false; break;
 
             case 'h': show_usage(stdout); return 0;
             case 'n':
@@ -163,8 +287,18 @@ tmain(int argc, tchar* argv[])
                 break;
 
             case 't':
-                options.nthreads = unsigned(atoi(toptarg));
-                fprintf(stderr, "using %d threads for decompression (experimental)\n", options.nthreads);
+                if (tstrcmp(toptarg, T("auto")) == 0) {
+                    options.decompress.nthreads     = topology::available_cpus();
+                    options.decompress.auto_threads = true;
+                    fprintf(stderr,
+                            "using up to %u threads for decompression (experimental)\n",
+                            options.decompress.nthreads);
+                } else {
+                    options.decompress.nthreads = unsigned(atoi(toptarg));
+                    fprintf(stderr,
+                            "using %u threads for decompression (experimental)\n",
+                            options.decompress.nthreads);
+                }
                 break;
             case 'V': show_version(); return 0;
             default: show_usage(stderr); return 1;
@@ -182,9 +316,18 @@ tmain(int argc, tchar* argv[])
             if (argv[i][0] == '-' && argv[i][1] == '\0') argv[i] = nullptr;
     }
 
-    ret = 0;
-    for (i = 0; i < argc; i++) {
-        ret |= -decompress_file(argv[i], &options);
+    if (options.first_line != 0 || options.pattern != nullptr) {
+        ret = 0;
+        for (i = 0; i < argc; i++)
+            ret |= -extract_indexed(argv[i], &options);
+    } else if (options.index_only) {
+        ret = decompress_files<DiscardConsumer>(argv, argc, &options, false);
+    } else if (options.count_lines) {
+        ret = decompress_files<LineCounter>(argv, argc, &options, false);
+    } else if (options.count_bytes) {
+        ret = decompress_files<ByteCounter>(argv, argc, &options, false);
+    } else {
+        ret = decompress_files<OutputConsumer>(argv, argc, &options, true);
     }
 
     /*
@@ -139,6 +139,7 @@ int wmain(int argc, wchar_t **argv);
 #  define	tstrlen		wcslen
 #  define	tstrrchr	wcsrchr
 #  define	tstrtoul	wcstoul
+#  define	tstrtoull	wcstoull
 #  define	tstrxcmp	wcsicmp
 #  define	tunlink		_wunlink
 #  define	tutimbuf	__utimbuf64
@@ -170,6 +171,7 @@ int wmain(int argc, wchar_t **argv);
 #  define	tstrlen		strlen
 #  define	tstrrchr	strrchr
 #  define	tstrtoul	strtoul
+#  define	tstrtoull	strtoull
 #  define	tstrxcmp	strcmp
 #  define	tunlink		unlink
 #  define	tutimbuf	utimbuf
@@ -0,0 +1,143 @@
+/*
+ * test_chunk_index.cpp
+ *
+ * Test the .pugzi index files (ChunkIndex): an index built while decompressing
+ * is written and read back unchanged, decompresses the stream like a plain
+ * decompression, and corrupted, truncated or stale index files are rejected.
+ */
+
+#include "test_util.hpp"
+
+using test::bytes_t;
+
+// Offsets in the index file (see ChunkIndex)
+static constexpr size_t footer_offset  = 16;
+static constexpr size_t entries_offset = 40;
+
+static void
+assert_same_entries(const ChunkIndex& a, const ChunkIndex& b)
+{
+    ASSERT(a.entries().size() == b.entries().size());
+    for (size_t i = 0; i < a.entries().size(); i++) {
+        const ChunkIndex::entry_t& x = a.entries()[i];
+        const ChunkIndex::entry_t& y = b.entries()[i];
+        ASSERT(x.bitpos == y.bitpos && x.out_offset == y.out_offset && x.lines == y.lines);
+        ASSERT(x.context == y.context && x.sketch == y.sketch);
+    }
+}
+
+/// Whether an index file holding file_data is read
+static bool
+reads(const test::TempFile& file, const bytes_t& file_data)
+{
+    file.write(file_data);
+    ChunkIndex index;
+    return index.read(file.path());
+}
+
+static void
+test_round_trip(const bytes_t& data, const bytes_t& gz, bool sketches)
+{
+    ChunkIndex built;
+    ASSERT(test::decompress(gz, 4, nullptr, &built, sketches) == data);
+    ASSERT(built.entries().size() > 2);
+    ASSERT(built.matches(test::as_bytes(gz), gz.size()));
+    ASSERT(built.has_sketches() == sketches);
+
+    const test::TempFile file{"round_trip.pugzi"};
+    built.write(file.path());
+    ChunkIndex index;
+    ASSERT(index.read(file.path()));
+    assert_same_entries(built, index);
+    ASSERT(index.matches(test::as_bytes(gz), gz.size()));
+
+    // Chunks are decoded from the index, with any number of threads
+    for (unsigned nthreads : {1, 2, 4, 8})
+        ASSERT(test::decompress(gz, nthreads, &index) == data);
+}
+
+static void
+test_rejected(const bytes_t& data, const bytes_t& gz)
+{
+    ChunkIndex built;
+    test::decompress(gz, 4, nullptr, &built);
+    const test::TempFile file{"rejected.pugzi"};
+    built.write(file.path());
+    const bytes_t valid = file.read();
+    ASSERT(reads(file, valid));
+
+    // Wrong magic, or another version of the format
+    for (size_t pos : {0, 7}) {
+        bytes_t bad = valid;
+        bad[pos] ^= 1;
+        ASSERT(!reads(file, bad));
+    }
+
+    // Truncated anywhere, or followed by garbage
+    for (size_t size : {size_t(0), size_t(5), entries_offset, entries_offset + 8, valid.size() / 2, valid.size() - 1})
+        ASSERT(!reads(file, bytes_t(valid.begin(), valid.begin() + long(size))));
+    bytes_t longer = valid;
+    longer.push_back(0);
+    ASSERT(!reads(file, longer));
+
+    // A count of entries that doesn't match the file
+    bytes_t bad_count = valid;
+    bad_count[entries_offset - 1] = 0x7f;
+    ASSERT(!reads(file, bad_count));
+
+    // The first entry is not the start of the stream
+    bytes_t bad_first = valid;
+    bad_first[entries_offset] = 1;
+    ASSERT(!reads(file, bad_first));
+
+    // The entries are not in stream order
+    bytes_t      swapped = valid;
+    const size_t second  = entries_offset + 3 * 8;
+    const size_t third   = second + 3 * 8 + ChunkIndex::context_size;
+    std::swap_ranges(
+      swapped.begin() + long(second), swapped.begin() + long(second + 3 * 8), swapped.begin() + long(third));
+    ASSERT(!reads(file, swapped));
+
+    // A context holding a byte no decoder outputs
+    for (uint8_t c : {uint8_t(0), uint8_t('\t' - 1), uint8_t('~' + 1), uint8_t(0xff)}) {
+        bytes_t bad_context = valid;
+        bad_context[second + 3 * 8 + ChunkIndex::context_size / 2] = c;
+        ASSERT(!reads(file, bad_context));
+    }
+
+    // A chunk starting in the gzip footer, past the deflate stream: the index is read, but doesn't match the file
+    bytes_t      past_end  = valid;
+    const size_t last      = valid.size() - 3 * 8 - ChunkIndex::context_size;
+    const size_t bad_start = 8 * (gz.size() - 4);
+    for (unsigned i = 0; i < 8; i++)
+        past_end[last + i] = uint8_t(bad_start >> (8 * i));
+    file.write(past_end);
+    ChunkIndex past;
+    ASSERT(past.read(file.path()));
+    ASSERT(!past.matches(test::as_bytes(gz), gz.size()));
+
+    // A wrong footer: the index is read, but doesn't match the gzip file anymore
+    bytes_t bad_footer = valid;
+    bad_footer[footer_offset] ^= 1;
+    file.write(bad_footer);
+    ChunkIndex stale;
+    ASSERT(stale.read(file.path()));
+    ASSERT(!stale.matches(test::as_bytes(gz), gz.size()));
+
+    // Nor does an index of another gzip file
+    bytes_t other_data = data;
+    other_data[0] ^= 1;
+    const bytes_t other = test::gzip_compress(other_data, 1);
+    ASSERT(!built.matches(test::as_bytes(other), other.size()));
+}
+
+int
+main()
+{
+    const bytes_t data = test::fastq_like(120000);
+    const bytes_t gz   = test::gzip_compress(data, 1);
+    test_round_trip(data, gz, false);
+    test_round_trip(data, gz, true);
+    test_rejected(data, gz);
+    return 0;
+}
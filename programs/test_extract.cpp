@@ -0,0 +1,245 @@
+/*
+ * test_extract.cpp
+ *
+ * Test the random access to a gzip file with an index (lib/extract.hpp):
+ * pugz::extract() against the bytes of the stream, pugz::extract_lines()
+ * against its lines (like sed -n), and pugz::grep() against the lines holding
+ * a fixed string (like grep -F), around and across the chunks of the index and
+ * past the end of the stream.
+ */
+
+#include "test_util.hpp"
+
+#include "../lib/extract.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using test::bytes_t;
+
+/// A gzip stream, its content and its index (with sketches), built by nthreads
+struct indexed_t
+{
+    explicit indexed_t(bytes_t data_, unsigned nthreads = 4)
+      : data(std::move(data_))
+      , gz(test::gzip_compress(data, 1))
+    {
+        ASSERT(test::decompress(gz, nthreads, nullptr, &index, true) == data);
+        for (size_t pos = 0; pos < data.size(); pos++)
+            if (data[pos] == '\n') line_ends.push_back(pos + 1);
+        if (data.empty() || data.back() != '\n') line_ends.push_back(data.size());
+    }
+
+    /// The bytes [offset, offset + length) of the stream, less at its end
+    bytes_t bytes(size_t offset, size_t length) const
+    {
+        offset = std::min(offset, data.size());
+        length = std::min(length, data.size() - offset);
+        return {data.begin() + long(offset), data.begin() + long(offset + length)};
+    }
+
+    /// The nlines lines from first_line (from 0), like sed -n 'first_line+1,first_line+nlines p'
+    bytes_t lines(size_t first_line, size_t nlines) const
+    {
+        if (nlines == 0 || first_line >= line_ends.size()) return {};
+        const size_t begin = first_line == 0 ? 0 : line_ends[first_line - 1];
+        const size_t end   = line_ends[std::min(first_line + nlines, line_ends.size()) - 1];
+        return bytes(begin, end - begin);
+    }
+
+    /// The lines holding pattern, like grep -F pattern
+    bytes_t grep(const std::string& pattern, size_t& nmatches) const
+    {
+        bytes_t out;
+        nmatches = 0;
+        for (size_t line = 0; line < line_ends.size(); line++) {
+            const bytes_t     text = lines(line, 1);
+            const std::string str(text.begin(), text.end());
+            if (str.find(pattern) == std::string::npos) continue;
+            out.insert(out.end(), text.begin(), text.end());
+            nmatches++;
+        }
+        return out;
+    }
+
+    bytes_t             data;
+    bytes_t             gz;
+    ChunkIndex          index     = {};
+    std::vector<size_t> line_ends = {}; // Offset after each line
+};
+
+static void
+test_extract(const indexed_t& f)
+{
+    const size_t size = f.data.size();
+    std::vector<std::pair<size_t, size_t>> ranges
+      = {{0, 0}, {0, 1}, {0, size}, {1, size}, {size - 5, 100}, {size, 10}, {size + 100, 10}, {0, SIZE_MAX}};
+    for (const auto& entry : f.index.entries()) {
+        const size_t b = entry.out_offset;
+        if (b == 0) continue;
+        ranges.push_back({b - 10, 20});          // Across the chunk boundary
+        ranges.push_back({b - 1, 1});            // Last byte before it
+        ranges.push_back({b, 1});                // First byte after it
+        ranges.push_back({b - 100000, 3 << 20}); // Over several chunks
+    }
+
+    for (unsigned nthreads : {1, 4}) {
+        for (const auto& range : ranges) {
+            bytes_t              out;
+            test::BufferConsumer sink{&out};
+            const size_t         n = pugz::extract(
+              test::as_bytes(f.gz), f.gz.size(), f.index, range.first, range.second, sink, nthreads);
+            ASSERT(out == f.bytes(range.first, range.second));
+            ASSERT(n == out.size());
+        }
+    }
+
+    // Nearby ranges, served from the cache of an extractor
+    pugz::Extractor extractor{test::as_bytes(f.gz), f.gz.size(), f.index};
+    const size_t    b = f.index.entries()[1].out_offset;
+    for (size_t offset : {b + 1000, b + 900, b + 2000, b + 1000}) {
+        bytes_t              out;
+        test::BufferConsumer sink{&out};
+        extractor.extract(offset, 5000, sink);
+        ASSERT(out == f.bytes(offset, 5000));
+    }
+
+    // Ranges over several chunks, by the threads of one extractor, which outlive a sink throwing
+    pugz::Extractor threaded{test::as_bytes(f.gz), f.gz.size(), f.index, 4};
+    for (size_t offset : {size_t(0), b - 100000, b + 1000}) {
+        bytes_t              out;
+        test::BufferConsumer sink{&out};
+        threaded.extract(offset, SIZE_MAX, sink);
+        ASSERT(out == f.bytes(offset, SIZE_MAX));
+
+        bool thrown = false;
+        try {
+            threaded.extract(offset, SIZE_MAX, [](span<const uint8_t>) { throw std::runtime_error("sink"); });
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        ASSERT(thrown);
+    }
+}
+
+/// The states where a decoding stops and of the last block boundary before its range, with the context of the latter
+/// decoded again from the last copy of it (or from the indexed chunk start)
+static void
+test_resume_points(const indexed_t& f)
+{
+    InputStream header_stream(test::as_bytes(f.gz), f.gz.size());
+    header_stream.consume_header();
+    const InputStream   in_stream(header_stream.in_next, header_stream.available());
+    pugz::RangeConsumer consumer;
+    pugz::RangeDecoder  decoder{in_stream, consumer};
+
+    constexpr size_t spacing    = pugz::RangeDecoder::context_copy_spacing;
+    const auto&      from       = f.index.entries()[1];
+    const size_t     chunk_size = f.index.entries()[2].out_offset - from.out_offset;
+    ASSERT(chunk_size > 3 * spacing);
+    for (size_t offset : {size_t(1000), spacing / 2, spacing + 1000, 3 * spacing - 1000, chunk_size - 1000}) {
+        const size_t                             begin = from.out_offset + offset;
+        bytes_t                                  out;
+        std::vector<pugz::RangeDecoder::state_t> resume_points;
+
+        auto append = [&](span<const uint8_t> data) { out.insert(out.end(), data.begin(), data.end()); };
+        ASSERT(decoder.decode(from, {begin, begin + 10, pugz::OutputRange::unit_t::BYTES}, append, resume_points));
+        ASSERT(out == f.bytes(begin, 10));
+        ASSERT(!resume_points.empty() && resume_points.size() <= 2);
+        if (offset > spacing) ASSERT(resume_points.size() == 2); // Many blocks before the range
+        if (resume_points.size() == 2) ASSERT(resume_points[0].out_offset <= begin);
+        ASSERT(resume_points.back().out_offset >= begin + 10);
+
+        for (const auto& state : resume_points) {
+            ASSERT(state.out_offset > from.out_offset);
+            ASSERT(state.context == f.bytes(state.out_offset - ChunkIndex::context_size, ChunkIndex::context_size));
+            ASSERT(state.lines == size_t(std::count(f.data.begin(), f.data.begin() + long(state.out_offset), '\n')));
+        }
+    }
+}
+
+static void
+test_extract_lines(const indexed_t& f)
+{
+    const size_t nlines = f.line_ends.size();
+    // An empty range (like m > n), ranges past the end, and the whole stream
+    std::vector<std::pair<size_t, size_t>> ranges
+      = {{0, 0}, {5, 0}, {0, 1}, {0, nlines}, {nlines - 2, 10}, {nlines, 1}, {nlines + 10, 4}, {3, SIZE_MAX}};
+    for (const auto& entry : f.index.entries()) {
+        const size_t line = entry.lines;
+        if (line == 0) continue;
+        ranges.push_back({line - 1, 1}); // The line the chunk starts in
+        ranges.push_back({line, 1});     // The first whole line of the chunk
+        ranges.push_back({line - 4, 8});
+        ranges.push_back({line - 10000, 40000});
+    }
+
+    for (unsigned nthreads : {1, 4}) {
+        for (const auto& range : ranges) {
+            bytes_t              out;
+            test::BufferConsumer sink{&out};
+            const size_t         n = pugz::extract_lines(
+              test::as_bytes(f.gz), f.gz.size(), f.index, range.first, range.second, sink, nthreads);
+            ASSERT(out == f.lines(range.first, range.second));
+            ASSERT(n == out.size());
+        }
+    }
+}
+
+/// A pattern crossing the boundary of the second chunk, which is within a line
+static std::string
+crossing_pattern(const indexed_t& f)
+{
+    const size_t b          = f.index.entries()[1].out_offset;
+    size_t       line_start = b;
+    while (line_start > 0 && f.data[line_start - 1] != '\n')
+        line_start--;
+    ASSERT(line_start < b && f.data[b] != '\n');
+    const size_t begin = std::max(line_start, b - 6);
+    size_t       end   = b;
+    while (end < b + 6 && f.data[end] != '\n')
+        end++;
+    return {f.data.begin() + long(begin), f.data.begin() + long(end)};
+}
+
+static void
+test_grep(const indexed_t& f, const std::vector<std::string>& patterns)
+{
+    for (unsigned nthreads : {1, 4}) {
+        for (const auto& pattern : patterns) {
+            bytes_t              out;
+            test::BufferConsumer sink{&out};
+            const auto*          p = reinterpret_cast<const uint8_t*>(pattern.data());
+            const size_t         n
+              = pugz::grep(test::as_bytes(f.gz), f.gz.size(), f.index, {p, pattern.size()}, sink, nthreads);
+            size_t expected_matches;
+            ASSERT(out == f.grep(pattern, expected_matches));
+            ASSERT(n == expected_matches);
+        }
+    }
+}
+
+int
+main()
+{
+    const indexed_t fastq{test::fastq_like(120000)};
+    ASSERT(fastq.index.entries().size() > 2);
+    test_extract(fastq);
+    test_resume_points(fastq);
+    test_extract_lines(fastq);
+    test_grep(fastq, {"@read1234 ", "@read119999 ", "lane:3", "GT", "ZZZZZ", "+", crossing_pattern(fastq)});
+
+    // The same chunks are indexed by a single thread
+    const indexed_t sequential{fastq.data, 1};
+    ASSERT(sequential.index.entries().size() == fastq.index.entries().size());
+    test_extract_lines(sequential);
+
+    // The last line has no line feed
+    bytes_t data = test::fastq_like(1000, 2);
+    data.pop_back();
+    const indexed_t unterminated{data};
+    test_extract_lines(unterminated);
+    test_grep(unterminated, {"@read999 ", std::string(data.end() - 3, data.end())});
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * test_find_block.cpp
+ *
+ * Test that DeflateParser::find_block() syncs on actual block boundaries, in
+ * streams of dynamic Huffman blocks and in streams made only of fixed Huffman
+ * blocks (which are tried when no dynamic block is found), and that such
+ * streams decompress with several threads. The checks on the block headers
+ * must accept every actual block, and reject random bits. Also test that the
+ * block map built by several threads lists every block.
+ */
+
+#include "test_util.hpp"
+
+#include <set>
+#include <thread>
+
+using test::bytes_t;
+
+/// The deflate stream of a gzip stream
+static InputStream
+deflate_stream(const bytes_t& gz)
+{
+    InputStream in_stream(test::as_bytes(gz), gz.size());
+    in_stream.consume_header();
+    return {in_stream.in_next, in_stream.available()};
+}
+
+/// Bit positions of the blocks of a deflate stream, found by decoding it block by block
+static std::set<size_t>
+block_starts(const InputStream& in_stream)
+{
+    DeflateParser    parser{in_stream};
+    std::set<size_t> starts;
+    size_t           pos = 0;
+    for (;;) {
+        starts.insert(pos);
+        size_t     out_size;
+        const auto res = parser.check_block(pos, out_size);
+        if (res == DeflateParser::block_result::LAST_BLOCK) break;
+        ASSERT(res == DeflateParser::block_result::SUCCESS);
+        pos = parser.position_bits();
+    }
+    return starts;
+}
+
+static void
+test_syncs(const bytes_t& data, int strategy)
+{
+    const bytes_t          gz        = test::gzip_compress(data, 6, strategy);
+    const InputStream      in_stream = deflate_stream(gz);
+    const std::set<size_t> starts    = block_starts(in_stream);
+    ASSERT(starts.size() > 8);
+
+    DeflateParser parser{in_stream};
+    const size_t  size_bits = 8 * in_stream.size();
+    for (unsigned k = 1; k < 8; k++) {
+        const size_t found = parser.find_block(size_bits / 8 * k);
+        ASSERT(found < size_bits);
+        ASSERT(starts.count(found) == 1);
+    }
+
+    // The header checks accept every actual (non final) dynamic block
+    if (strategy == Z_DEFAULT_STRATEGY) {
+        for (auto it = starts.begin(); std::next(it) != starts.end(); ++it)
+            ASSERT(parser.find_block(*it) == *it);
+    }
+
+    // The input stream cannot be placed within the last 8 bytes
+    size_t out_size;
+    ASSERT(parser.check_block(size_bits - 8, out_size) == DeflateParser::block_result::NOT_ENOUGH_INPUT);
+    ASSERT(out_size == 0);
+    ASSERT(parser.find_block(size_bits - 64) == size_bits);
+
+    ASSERT(test::decompress(gz, 4) == data);
+}
+
+/// The block map built by several threads lists the blocks of the stream, with their decompressed size
+static void
+test_block_map(const bytes_t& data)
+{
+    const bytes_t          gz        = test::gzip_compress(data);
+    const InputStream      in_stream = deflate_stream(gz);
+    const std::set<size_t> starts    = block_starts(in_stream);
+    ASSERT(in_stream.size() > 2 * BlockMap::slice_size);
+
+    BlockMap                 block_map{in_stream.size()};
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < 3; i++) {
+        threads.emplace_back([&]() {
+            DeflateParser parser{in_stream};
+            block_map.scan(parser);
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    size_t out_size = 0;
+    ASSERT(block_map.blocks().size() == starts.size());
+    for (const auto& block : block_map.blocks()) {
+        ASSERT(starts.count(block.bitpos) == 1);
+        out_size += block.out_size;
+    }
+    ASSERT(out_size == data.size());
+}
+
+/// Random bits hold no block that passes the header checks
+static void
+test_random()
+{
+    std::mt19937 rng{1};
+    bytes_t      noise(256 << 10);
+    for (auto& byte : noise)
+        byte = uint8_t(rng());
+
+    const InputStream in_stream(test::as_bytes(noise), noise.size());
+    DeflateParser     parser{in_stream};
+    ASSERT(parser.find_block(0) == 8 * in_stream.size());
+}
+
+int
+main()
+{
+    const bytes_t data = test::fastq_like(60000);
+    test_syncs(data, Z_DEFAULT_STRATEGY);
+    test_syncs(data, Z_FIXED);
+    test_random();
+    test_block_map(test::fastq_like(200000));
+    return 0;
+}
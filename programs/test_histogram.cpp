@@ -0,0 +1,60 @@
+/*
+ * test_histogram.cpp
+ *
+ * Test that a HistogramConsumer gets the exact byte counts of the output,
+ * whether the chunks are decoded sequentially or at random access (their
+ * symbol counts composed with the translation tables).
+ */
+
+#include "test_util.hpp"
+
+using test::bytes_t;
+
+/// Sums the counts it gets
+struct CountsConsumer : public HistogramConsumer
+{
+    virtual void add_counts(const byte_counts_t& data_counts)
+    {
+        std::lock_guard<std::mutex> lock{*mut};
+        for (unsigned c = 0; c < 256; c++)
+            (*counts)[c] += data_counts[c];
+    }
+
+    std::mutex*    mut;
+    byte_counts_t* counts;
+};
+
+static void
+test_counts(const bytes_t& data)
+{
+    const bytes_t gz = test::gzip_compress(data);
+
+    byte_counts_t expected = {};
+    for (uint8_t c : data)
+        expected[c]++;
+
+    for (unsigned nthreads : {1, 4}) {
+        for (bool pipelined : {true, false}) {
+            DecompressOptions options;
+            options.nthreads  = nthreads;
+            options.pipelined = pipelined;
+
+            DecompressorPool<CountsConsumer> pool{options};
+            std::mutex                       mut;
+            byte_counts_t                    counts = {};
+            CountsConsumer                   consumer;
+            consumer.mut    = &mut;
+            consumer.counts = &counts;
+            pool.decompress(test::as_bytes(gz), gz.size(), consumer, nullptr);
+            ASSERT(counts == expected);
+        }
+    }
+}
+
+int
+main()
+{
+    test_counts(test::fastq_like(200000));
+    test_counts({'A', 'C', 'G', 'T', '\n'});
+    return 0;
+}
@@ -0,0 +1,300 @@
+/*
+ * test_literal_pairs.cpp
+ *
+ * Test the litlen decode table entries holding two literals (pair_literals())
+ * at the edges of the main table, with a dynamic Huffman code built for it:
+ * literal codewords from 2 to 15 bits long give pairs exactly as long as the
+ * main table, first literals as long as the main table (never paired), and
+ * pairs followed by symbols decoded through a subtable, by a match or by the
+ * end of block.  The table entries are checked, then a stream of such blocks
+ * is decoded with the 10, 11 and 12 bits geometries, by one and several
+ * threads.
+ */
+
+#include "test_util.hpp"
+
+#include <algorithm>
+#include <memory>
+
+using test::bytes_t;
+
+// The literals 'a' to 'm' have codewords of 2 to 14 bits, 'n' and 'o' of 15 bits. The end of block and the match of
+// length 3 have 2 bits codewords. The offset code has the distances 1 and 4.
+static const unsigned num_litlen_syms = 258;
+static const unsigned num_offset_syms = 4;
+static const unsigned match_sym       = 257;
+
+static std::vector<uint8_t>
+litlen_lens()
+{
+    std::vector<uint8_t> lens(num_litlen_syms, 0);
+    for (unsigned c = 'a'; c <= 'm'; c++)
+        lens[c] = uint8_t(2 + c - 'a');
+    lens['n'] = lens['o']       = 15;
+    lens[DEFLATE_END_OF_BLOCK]  = 2;
+    lens[match_sym]             = 2;
+    return lens;
+}
+
+static const std::vector<uint8_t> offset_lens = {1, 0, 0, 1};
+
+/// Canonical Huffman codewords of code lengths (RFC 1951, 3.2.2), bit-reversed to be written LSB first
+static std::vector<uint32_t>
+canonical_codes(const std::vector<uint8_t>& lens)
+{
+    unsigned count[16] = {}, next[16] = {};
+    for (uint8_t len : lens)
+        count[len]++;
+    count[0] = 0;
+    for (unsigned len = 1, code = 0; len < 16; len++)
+        next[len] = code = (code + count[len - 1]) << 1;
+
+    std::vector<uint32_t> codes(lens.size(), 0);
+    for (size_t sym = 0; sym < lens.size(); sym++) {
+        if (lens[sym] == 0) continue;
+        const uint32_t code = next[lens[sym]]++;
+        for (unsigned bit = 0; bit < lens[sym]; bit++)
+            codes[sym] |= (code >> bit & 1) << (lens[sym] - 1 - bit);
+    }
+    return codes;
+}
+
+/// Writes bits LSB first, like a deflate stream
+class BitWriter
+{
+  public:
+    void put(uint32_t bits, unsigned count)
+    {
+        _buf |= uint64_t(bits) << _count;
+        for (_count += count; _count >= 8; _count -= 8, _buf >>= 8)
+            _bytes.push_back(uint8_t(_buf));
+    }
+
+    bytes_t finish()
+    {
+        if (_count > 0) put(0, 8 - _count);
+        return _bytes;
+    }
+
+  private:
+    bytes_t  _bytes = {};
+    uint64_t _buf   = 0;
+    unsigned _count = 0;
+};
+
+/// Writes dynamic blocks of the code, and keeps their output
+class BlockWriter
+{
+  public:
+    BlockWriter()
+      : _litlen_lens(litlen_lens())
+      , _litlen_codes(canonical_codes(_litlen_lens))
+      , _offset_codes(canonical_codes(offset_lens))
+    {}
+
+    void begin_block(bool final)
+    {
+        static const uint8_t precode_order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+        _bits.put(final, 1);
+        _bits.put(DEFLATE_BLOCKTYPE_DYNAMIC_HUFFMAN, 2);
+        _bits.put(num_litlen_syms - 257, 5);
+        _bits.put(num_offset_syms - 1, 5);
+        _bits.put(19 - 4, 4);
+        // The lengths 0 to 15 have 4 bits precode codewords, which are their value: the lengths are written as is
+        for (uint8_t presym : precode_order)
+            _bits.put(presym < 16 ? 4 : 0, 3);
+        for (uint8_t len : _litlen_lens)
+            put_reversed(len, 4);
+        for (uint8_t len : offset_lens)
+            put_reversed(len, 4);
+    }
+
+    void literal(uint8_t c)
+    {
+        _bits.put(_litlen_codes[c], _litlen_lens[c]);
+        out.push_back(c);
+    }
+
+    void literals(const char* s)
+    {
+        for (; *s != '\0'; s++)
+            literal(uint8_t(*s));
+    }
+
+    /// A match of length 3 at distance 1 or 4
+    void match(unsigned distance)
+    {
+        const unsigned offset_sym = distance == 1 ? 0 : 3;
+        ASSERT(out.size() >= distance);
+        _bits.put(_litlen_codes[match_sym], _litlen_lens[match_sym]);
+        _bits.put(_offset_codes[offset_sym], offset_lens[offset_sym]);
+        for (unsigned i = 0; i < 3; i++)
+            out.push_back(out[out.size() - distance]);
+    }
+
+    void end_block() { _bits.put(_litlen_codes[DEFLATE_END_OF_BLOCK], _litlen_lens[DEFLATE_END_OF_BLOCK]); }
+
+    bytes_t finish() { return _bits.finish(); }
+
+    bytes_t out = {};
+
+  private:
+    /// A precode codeword, which is the 4 bits value
+    void put_reversed(unsigned value, unsigned len)
+    {
+        unsigned reversed = 0;
+        for (unsigned bit = 0; bit < len; bit++)
+            reversed |= (value >> bit & 1) << (len - 1 - bit);
+        _bits.put(reversed, len);
+    }
+
+    BitWriter             _bits;
+    std::vector<uint8_t>  _litlen_lens;
+    std::vector<uint32_t> _litlen_codes;
+    std::vector<uint32_t> _offset_codes;
+};
+
+/// The entry of the litlen main table of 2^tablebits entries decoding the codewords of s (written LSB first)
+static uint32_t
+main_entry(const uint32_t* table, unsigned tablebits, const char* s)
+{
+    const std::vector<uint8_t>  lens  = litlen_lens();
+    const std::vector<uint32_t> codes = canonical_codes(lens);
+    uint32_t                    index = 0;
+    unsigned                    nbits = 0;
+    for (; *s != '\0'; s++) {
+        index |= codes[uint8_t(*s)] << nbits;
+        nbits += lens[uint8_t(*s)];
+    }
+    return table[index & ((1u << tablebits) - 1)];
+}
+
+static bool
+is_pair(uint32_t entry, char first, char second)
+{
+    const std::vector<uint8_t> lens = litlen_lens();
+    return (entry & HUFFDEC_LITERAL_PAIR) && char(entry >> HUFFDEC_RESULT_SHIFT) == first
+           && char(entry >> HUFFDEC_SECOND_LITERAL_SHIFT) == second
+           && (entry >> HUFFDEC_FIRST_LENGTH_SHIFT & HUFFDEC_FIRST_LENGTH_MASK) == lens[uint8_t(first)]
+           && (entry & HUFFDEC_LENGTH_MASK) == unsigned(lens[uint8_t(first)] + lens[uint8_t(second)]);
+}
+
+static bool
+is_literal(uint32_t entry, char c)
+{
+    return (entry & HUFFDEC_LITERAL) && !(entry & HUFFDEC_LITERAL_PAIR) && char(entry >> HUFFDEC_RESULT_SHIFT) == c;
+}
+
+template<unsigned tablebits>
+static void
+test_table()
+{
+    std::unique_ptr<libdeflate_decompressor> d{new libdeflate_decompressor()};
+    const std::vector<uint8_t>               lens = litlen_lens();
+    std::copy(lens.begin(), lens.end(), d->u.l.lens);
+    std::copy(offset_lens.begin(), offset_lens.end(), d->u.l.lens + num_litlen_syms);
+    ASSERT(build_offset_decode_table(d.get(), num_litlen_syms, num_offset_syms, ShouldSucceed{}));
+    ASSERT(build_litlen_decode_table<litlen_geometry<tablebits>>(d.get(), num_litlen_syms, ShouldSucceed{}));
+    const uint32_t* table = d->u.litlen_decode_table;
+
+    // 'a' + the literal filling the main table with it, or one bit too long
+    const char fits[]      = {'a', char('a' + tablebits - 4), '\0'};
+    const char too_long[]  = {'a', char('a' + tablebits - 3), '\0'};
+    const char first_max[] = {char('a' + tablebits - 2), 'a', '\0'}; // As long as the main table
+    ASSERT(is_pair(main_entry(table, tablebits, fits), fits[0], fits[1]));
+    ASSERT(is_literal(main_entry(table, tablebits, too_long), 'a'));
+    ASSERT(is_literal(main_entry(table, tablebits, first_max), first_max[0]));
+    ASSERT((main_entry(table, tablebits, first_max) & HUFFDEC_LENGTH_MASK) == tablebits);
+
+    // Pairs followed by a literal decoded through a subtable
+    ASSERT(is_pair(main_entry(table, tablebits, "aan"), 'a', 'a'));
+    ASSERT(is_pair(main_entry(table, tablebits, "abo"), 'a', 'b'));
+    ASSERT(main_entry(table, tablebits, "n") & HUFFDEC_SUBTABLE_POINTER);
+}
+
+/// Blocks of edge cases, then of random symbols, returns the gzip stream
+static bytes_t
+write_stream(BlockWriter& writer, std::mt19937& rng, unsigned nblocks)
+{
+    // The edge cases of each geometry: pairs of 10, 11 and 12 bits, first literals of 10, 11 and 12 bits
+    static const char* const edges[]
+      = {"ag", "ah", "ai", "bh", "bi", "cg", "ia", "ja", "ka", "aal", "aam", "aan", "abo", "agn", "ahm", "jj", "kk"};
+    for (unsigned block = 0; block < nblocks; block++) {
+        writer.begin_block(block + 1 == nblocks);
+        if (block == 0) writer.literals("abcd");
+        for (const char* edge : edges) {
+            writer.literals(edge);
+            writer.literals("aa");
+            writer.match(rng() % 2 ? 1 : 4); // After a pair
+        }
+        for (unsigned i = 0; i < 20000; i++) {
+            const unsigned r = rng() % 32;
+            if (r < 15) {
+                writer.literal(uint8_t('a' + r));
+            } else if (r < 29) {
+                writer.literal('a'); // The shortest codeword, in most pairs
+            } else {
+                writer.match(r % 2 ? 1 : 4);
+            }
+        }
+        writer.literals("ba"); // A pair before the end of block
+        writer.end_block();
+    }
+    const bytes_t deflate = writer.finish();
+
+    // Within a gzip member
+    bytes_t        gz    = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+    const uint32_t crc   = uint32_t(crc32(0, writer.out.data(), uInt(writer.out.size())));
+    const uint32_t isize = uint32_t(writer.out.size());
+    gz.insert(gz.end(), deflate.begin(), deflate.end());
+    for (unsigned i = 0; i < 4; i++)
+        gz.push_back(uint8_t(crc >> (8 * i)));
+    for (unsigned i = 0; i < 4; i++)
+        gz.push_back(uint8_t(isize >> (8 * i)));
+    return gz;
+}
+
+/// zlib decodes the stream, to check that it was written right
+static bytes_t
+zlib_decompress(const bytes_t& gz, size_t size)
+{
+    bytes_t  out(size);
+    z_stream strm = {};
+    ASSERT(inflateInit2(&strm, 15 + 16) == Z_OK);
+    strm.next_in   = const_cast<Bytef*>(gz.data());
+    strm.avail_in  = uInt(gz.size());
+    strm.next_out  = out.data();
+    strm.avail_out = uInt(out.size());
+    ASSERT(inflate(&strm, Z_FINISH) == Z_STREAM_END);
+    out.resize(strm.total_out);
+    inflateEnd(&strm);
+    return out;
+}
+
+int
+main()
+{
+    test_table<10>();
+    test_table<11>();
+    test_table<12>();
+
+    std::mt19937  rng{1};
+    BlockWriter   writer;
+    const bytes_t gz = write_stream(writer, rng, 500);
+    ASSERT(zlib_decompress(gz, writer.out.size()) == writer.out);
+
+    for (unsigned tablebits = LITLEN_MIN_TABLEBITS; tablebits <= LITLEN_MAX_TABLEBITS; tablebits++) {
+        for (unsigned nthreads : {1, 4}) {
+            DecompressOptions options;
+            options.nthreads         = nthreads;
+            options.litlen_tablebits = tablebits;
+            // Recording an index cuts the stream in chunks: several threads start decoding them after finding a
+            // block of the stream
+            DecompressorPool<test::BufferConsumer> pool{options};
+            ChunkIndex                             index;
+            ASSERT(test::decompress(gz, pool, nullptr, &index) == writer.out);
+            ASSERT(index.entries().size() > 1);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * test_multiplexer.cpp
+ *
+ * Test that BackrefMultiplexer narrows a 16bits context to 8bits symbols:
+ * resolved characters are kept, each back-reference offset gets its own
+ * symbol (the same one for every occurrence), the symbols translate to the
+ * characters of the resolved context, and the allocation starts over at each
+ * call. A context with more offsets than symbols can't be narrowed.
+ */
+
+#include "test_util.hpp"
+
+using Multiplexer = BackrefMultiplexer<>;
+
+/// Fill a 16bits context: even positions hold resolved characters, odd ones back-references to offset(i)
+template<typename Offset>
+static void
+fill_context(Window<uint16_t>& window, Offset&& offset)
+{
+    window.clear();
+    auto context = window.current_context();
+    for (size_t i = 0; i < context.size(); i++) {
+        context[i] = i % 2 == 0 ? uint16_t('A' + i % 26) : uint16_t(Multiplexer::first_backref_symbol + offset(i));
+    }
+}
+
+/// Check the narrowed context against the 16bits one, returns the number of distinct offsets
+static unsigned
+check_narrowed(Multiplexer& multiplexer, Window<uint16_t>& wide, Window<uint8_t>& narrow)
+{
+    std::vector<int> symbol_of_offset(Multiplexer::context_size, -1);
+    unsigned         offsets = 0;
+    for (size_t i = 0; i < Multiplexer::context_size; i++) {
+        const uint16_t c_from = wide.current_context()[i];
+        const uint8_t  c_to   = narrow.current_context()[i];
+        if (c_from < Multiplexer::first_backref_symbol) {
+            ASSERT(c_to == c_from);
+            continue;
+        }
+        const uint16_t offset = uint16_t(c_from - Multiplexer::first_backref_symbol);
+        ASSERT(c_to >= Multiplexer::first_backref_symbol && c_to < multiplexer.used_symbols);
+        ASSERT(multiplexer.lkt8to16bits[c_to] == offset);
+        if (symbol_of_offset[offset] < 0) {
+            symbol_of_offset[offset] = c_to;
+            offsets++;
+        }
+        ASSERT(symbol_of_offset[offset] == c_to);
+    }
+    ASSERT(multiplexer.used_symbols == Multiplexer::first_backref_symbol + offsets);
+    return offsets;
+}
+
+int
+main()
+{
+    Multiplexer      multiplexer;
+    Window<uint16_t> wide   = {};
+    Window<uint8_t>  narrow = {};
+
+    const auto scattered = [](size_t i) { return i / 2 * 7919 % 100; };
+    fill_context(wide, scattered);
+    ASSERT(multiplexer.compress_backref_symbols(wide, narrow));
+    ASSERT(multiplexer.is_compressed);
+    ASSERT(check_narrowed(multiplexer, wide, narrow) == 100);
+
+    // The symbols translate to the characters of the resolved context
+    std::vector<uint8_t> resolved(Multiplexer::context_size);
+    for (size_t i = 0; i < resolved.size(); i++)
+        resolved[i] = uint8_t('a' + i % 26);
+    multiplexer.compose_context({resolved.data(), resolved.size()});
+    for (size_t i = 1; i < Multiplexer::context_size; i += 2) {
+        ASSERT(multiplexer.lkt8bits2chr[narrow.current_context()[i]] == resolved[scattered(i)]);
+    }
+
+    // The next call allocates its symbols from the first one again, also for the offsets of the previous call
+    fill_context(wide, [](size_t i) { return 75 + i / 2 % 50; });
+    ASSERT(multiplexer.compress_backref_symbols(wide, narrow));
+    ASSERT(check_narrowed(multiplexer, wide, narrow) == 50);
+
+    // More offsets than symbols
+    fill_context(wide, [](size_t i) { return i / 2 % 200; });
+    ASSERT(!multiplexer.compress_backref_symbols(wide, narrow));
+    ASSERT(!multiplexer.is_compressed);
+    return 0;
+}
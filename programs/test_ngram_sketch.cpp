@@ -0,0 +1,137 @@
+/*
+ * test_ngram_sketch.cpp
+ *
+ * Test NgramSketch: every 4-gram of a text, and the patterns in it, test
+ * positive (no false negatives), including those spanning two texts, in the
+ * sketches built alone and in those of an index.  Patterns shorter than a
+ * 4-gram bypass the sketch.
+ */
+
+#include "test_util.hpp"
+
+#include <random>
+
+using test::bytes_t;
+
+static span<const uint8_t>
+bits_of(const std::vector<uint8_t>& bits)
+{
+    return {bits.data(), bits.size()};
+}
+
+static span<const uint8_t>
+part(const bytes_t& text, size_t begin, size_t end)
+{
+    return {text.data() + begin, text.data() + end};
+}
+
+/// Sketch a text, added in pieces of random sizes
+static void
+add_in_pieces(NgramSketch& sketch, const bytes_t& text, std::mt19937& rng)
+{
+    for (size_t pos = 0; pos < text.size();) {
+        const size_t end = std::min(text.size(), pos + rng() % 100);
+        sketch.add(part(text, pos, end));
+        pos = end;
+    }
+}
+
+/// Every 4-gram of text[begin, end) tests positive, and random longer patterns starting there
+static void
+assert_no_false_negatives(span<const uint8_t> bits,
+                          span<const uint8_t> next_bits,
+                          const bytes_t&      text,
+                          size_t              begin,
+                          size_t              end,
+                          std::mt19937&       rng)
+{
+    const size_t n = NgramSketch::ngram_size;
+    for (size_t pos = begin; pos + n <= end; pos++)
+        ASSERT(NgramSketch::may_contain(bits, {}, part(text, pos, pos + n)));
+    for (unsigned i = 0; i < 10000 && begin + n <= end; i++) {
+        const size_t pos = begin + rng() % (end - begin - n + 1);
+        const size_t len = std::min(end - pos, n + rng() % 60);
+        ASSERT(NgramSketch::may_contain(bits, next_bits, part(text, pos, pos + len)));
+    }
+}
+
+static void
+test_texts(std::mt19937& rng)
+{
+    const bytes_t first  = test::fastq_like(2000, 3);
+    bytes_t       second = test::fastq_like(2000, 4);
+    for (size_t i = 0; i < 1000; i++) // And binary data
+        second.push_back(uint8_t(rng()));
+    bytes_t both = first;
+    both.insert(both.end(), second.begin(), second.end());
+
+    NgramSketch first_sketch, second_sketch;
+    add_in_pieces(first_sketch, first, rng);
+    add_in_pieces(second_sketch, second, rng);
+    first_sketch.add_boundary(second_sketch);
+
+    assert_no_false_negatives(bits_of(second_sketch.bits()), {}, second, 0, second.size(), rng);
+    // The 4-grams spanning the texts are in the first one, the longer patterns may be in both
+    const size_t first_end = first.size() + NgramSketch::ngram_size - 1;
+    assert_no_false_negatives(bits_of(first_sketch.bits()), bits_of(second_sketch.bits()), both, 0, first_end, rng);
+    for (size_t pos = first.size() - 100; pos < first.size() + 100; pos++) {
+        const auto pattern = part(both, pos, pos + 20);
+        ASSERT(NgramSketch::may_contain(bits_of(first_sketch.bits()), bits_of(second_sketch.bits()), pattern));
+    }
+
+    // A sketch rules patterns out, but not those shorter than a 4-gram
+    NgramSketch   empty;
+    const uint8_t pattern[] = {'A', 'C', 'G', 'T'};
+    ASSERT(!NgramSketch::may_contain(bits_of(empty.bits()), {}, {pattern, pattern + 4}));
+    for (size_t len = 0; len < NgramSketch::ngram_size; len++)
+        ASSERT(NgramSketch::may_contain(bits_of(empty.bits()), {}, {pattern, pattern + len}));
+    // Without a sketch, anything may be in the text
+    ASSERT(NgramSketch::may_contain({}, {}, {pattern, pattern + 4}));
+
+    // Random patterns not in a small text are mostly ruled out
+    NgramSketch small;
+    small.add(part(first, 0, 10000));
+    unsigned ruled_out = 0;
+    for (unsigned i = 0; i < 1000; i++) {
+        uint8_t random[8];
+        for (uint8_t& c : random)
+            c = uint8_t(rng());
+        ruled_out += !NgramSketch::may_contain(bits_of(small.bits()), {}, {random, random + 8});
+    }
+    ASSERT(ruled_out > 950);
+}
+
+/// The sketches of an index (built by nthreads) hold every 4-gram of their chunk, including those ending in the next
+/// chunk
+static void
+test_index_sketches(std::mt19937& rng, unsigned nthreads)
+{
+    const bytes_t data = test::fastq_like(60000);
+    const bytes_t gz   = test::gzip_compress(data);
+    ChunkIndex    index;
+    ASSERT(test::decompress(gz, nthreads, nullptr, &index, true) == data);
+    ASSERT(index.has_sketches() && index.entries().size() > 1);
+
+    const auto& entries = index.entries();
+    for (size_t chunk = 0; chunk < entries.size(); chunk++) {
+        const bool   last  = chunk + 1 == entries.size();
+        const size_t begin = entries[chunk].out_offset;
+        const size_t end   = last ? data.size() : entries[chunk + 1].out_offset + NgramSketch::ngram_size - 1;
+        assert_no_false_negatives(bits_of(entries[chunk].sketch),
+                                  last ? span<const uint8_t>{} : bits_of(entries[chunk + 1].sketch),
+                                  data,
+                                  begin,
+                                  end,
+                                  rng);
+    }
+}
+
+int
+main()
+{
+    std::mt19937 rng{1};
+    test_texts(rng);
+    test_index_sketches(rng, 1);
+    test_index_sketches(rng, 4);
+    return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * test_pool.cpp
+ *
+ * Test that a DecompressorPool decompresses several gzip streams in a row with
+ * the same threads, and that it leaves the input untouched when the streams are
+ * not file mappings: a heap buffer can be decompressed again. Also test how many
+ * threads a stream gets.
+ */
+
+#include "test_util.hpp"
+
+using test::bytes_t;
+
+static void
+test_threads_for()
+{
+    constexpr size_t MiB = 1 << 20;
+
+    DecompressOptions options;
+    options.nthreads = 8;
+    ASSERT(options.threads_for(0) == 1);
+    ASSERT(options.threads_for(1 * MiB) == 1);
+    ASSERT(options.threads_for(2 * MiB) == 2);
+    ASSERT(options.threads_for(100 * MiB) == 8);
+
+    // In auto mode, a thread for each 4MiB
+    options.auto_threads = true;
+    ASSERT(options.threads_for(1 * MiB) == 1);
+    ASSERT(options.threads_for(4 * MiB) == 1);
+    ASSERT(options.threads_for(12 * MiB) == 3);
+    ASSERT(options.threads_for(100 * MiB) == 8);
+}
+
+int
+main()
+{
+    test_threads_for();
+
+    const bytes_t data  = test::fastq_like(200000);
+    const bytes_t other = test::fastq_like(1000, 2);
+    const bytes_t gz    = test::gzip_compress(data);
+    const bytes_t gz2   = test::gzip_compress(other);
+    const bytes_t copy  = gz;
+
+    for (unsigned nthreads : {1, 4}) {
+        DecompressOptions options;
+        options.nthreads = nthreads;
+
+        DecompressorPool<test::BufferConsumer> pool{options};
+        ASSERT(test::decompress(gz, pool) == data);
+        ASSERT(gz == copy);
+        ASSERT(test::decompress(gz2, pool) == other);
+        ASSERT(test::decompress(gz, pool) == data);
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * test_resync.cpp
+ *
+ * Test that a random access chunk recovers when the previous chunk did not
+ * stop right before its first block (the block was a false positive, or the
+ * previous chunk stopped earlier): the chunk is decoded again from where the
+ * previous chunk stopped, with its context, and the output is unchanged.
+ */
+
+#include "test_util.hpp"
+
+using test::bytes_t;
+
+int
+main()
+{
+    const bytes_t data = test::fastq_like(100000);
+    const bytes_t gz   = test::gzip_compress(data);
+
+    InputStream header_stream(test::as_bytes(gz), gz.size());
+    header_stream.consume_header();
+    const InputStream in_stream(header_stream.in_next, header_stream.available());
+    const size_t      in_bits = 8 * in_stream.size();
+
+    // A block in the first half of the stream, where the previous chunk will stop
+    bytes_t                               probe_out;
+    test::BufferConsumer                  probe_consumer{&probe_out};
+    ConsumerWrapper<test::BufferConsumer> probe_wrapper{probe_consumer};
+    ChunkBoundary                         probe_boundary;
+    DeflateThreadRandomAccess             probe{in_stream, probe_wrapper};
+    probe.set_upstream(&probe_boundary);
+    const size_t block_pos = probe.sync(in_bits / 4);
+    ASSERT(block_pos < in_bits / 2);
+
+    bytes_t                               out, tail_out;
+    test::BufferConsumer                  consumer{&out}, tail_consumer{&tail_out};
+    ConsumerWrapper<test::BufferConsumer> wrapper{consumer}, tail_wrapper{tail_consumer};
+    wrapper.set_chunk_idx(0);
+    tail_wrapper.set_chunk_idx(1, true);
+
+    // The second chunk syncs after the block, then the first chunk stops at the block instead of its synced position
+    ChunkBoundary             boundary, end;
+    DeflateThreadRandomAccess tail{in_stream, tail_wrapper};
+    tail.set_upstream(&boundary);
+    tail.set_downstream(&end);
+    tail.decode(in_bits / 2, []() {});
+    boundary.set_end_block(block_pos);
+
+    DeflateThread head{in_stream, wrapper};
+    head.set_downstream(&boundary);
+    head.go(0);
+
+    ASSERT(tail.resolve_context());
+    tail.flush();
+    out.insert(out.end(), tail_out.begin(), tail_out.end());
+    ASSERT(out == data);
+    return 0;
+}
@@ -0,0 +1,288 @@
+/*
+ * test_scheduler.cpp
+ *
+ * Test that ChunkScheduler hands out chunks in stream order, covering the
+ * stream without gaps nor overlaps, each chunk waiting for the context left by
+ * the previous one, when the chunks are dequeued by several threads at once.
+ * Also test that the chunks are sized from the measured decoding speed, and
+ * that a chunk can check whether the context of the previous chunk is ready
+ * without waiting (to decode another chunk meanwhile), and that random access
+ * chunks are sized for their output to fit their buffer. Chunks reserved to be
+ * synced ahead of time are handed out first, once synced. Contexts posted as
+ * functions of the previous contexts are composed once these are known.
+ */
+
+#include "test_util.hpp"
+
+#include <algorithm>
+#include <thread>
+
+using test::bytes_t;
+
+/// Dequeue all the chunks of the scheduler with nthreads threads, returns them in the order of their index
+static std::vector<ChunkTask>
+dequeue_all(ChunkScheduler& scheduler, unsigned nthreads)
+{
+    std::mutex               mut;
+    std::vector<ChunkTask>   tasks;
+    std::vector<std::thread> threads;
+    for (unsigned thread_idx = 0; thread_idx < nthreads; thread_idx++) {
+        threads.emplace_back([&]() {
+            ChunkTask task;
+            while (scheduler.next(task)) {
+                std::lock_guard<std::mutex> lock{mut};
+                tasks.push_back(task);
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    std::sort(tasks.begin(), tasks.end(), [](const ChunkTask& a, const ChunkTask& b) { return a.idx < b.idx; });
+    return tasks;
+}
+
+static void
+test_chunks(size_t in_size, unsigned nthreads)
+{
+    const bytes_t     in(in_size);
+    const InputStream in_stream(test::as_bytes(in), in.size());
+    ChunkThroughput   throughput;
+    ChunkScheduler    scheduler{in_stream, nullptr, nthreads, throughput};
+
+    const std::vector<ChunkTask> tasks = dequeue_all(scheduler, nthreads);
+    ASSERT(!tasks.empty());
+    if (nthreads == 1) ASSERT(tasks.size() == 1);
+    if (in_size >= nthreads * ChunkScheduler::min_chunk_size) ASSERT(tasks.size() >= nthreads);
+
+    for (size_t i = 0; i < tasks.size(); i++) {
+        const ChunkTask& task = tasks[i];
+        const size_t     size = task.stop - task.start;
+        ASSERT(task.idx == i);
+        ASSERT(task.start == (i == 0 ? 0 : tasks[i - 1].stop));
+        ASSERT(task.stop > task.start);
+        ASSERT(task.is_last == (i + 1 == tasks.size()));
+        ASSERT(task.upstream == (i == 0 ? nullptr : tasks[i - 1].downstream));
+        ASSERT(task.downstream != nullptr && task.downstream->get_stop_pos() == 8 * task.stop);
+        if (tasks.size() > 1) ASSERT(size >= ChunkScheduler::min_chunk_size);
+        ASSERT(size <= std::max(ChunkScheduler::max_chunk_size, in_size / nthreads));
+
+        // Chunks shrink toward the end of the stream (the first one is larger, as it decodes faster), but for a tail
+        // too small to be a chunk of its own
+        const size_t prev_size = i > 0 ? tasks[i - 1].stop - tasks[i - 1].start : 0;
+        if (i > 1) ASSERT(size <= prev_size || (task.is_last && size < 2 * ChunkScheduler::min_chunk_size));
+    }
+    ASSERT(tasks.back().stop == in_size);
+}
+
+/// Sizes of the first chunks of a 200MiB stream decoded by 4 threads at the measured throughput
+static std::vector<size_t>
+first_chunk_sizes(ChunkThroughput& throughput)
+{
+    const bytes_t     in(200 << 20);
+    const InputStream in_stream(test::as_bytes(in), in.size());
+    ChunkScheduler    scheduler{in_stream, nullptr, 4, throughput};
+
+    std::vector<size_t> sizes;
+    ChunkTask           task;
+    for (unsigned i = 0; i < 2 && scheduler.next(task); i++)
+        sizes.push_back(task.stop - task.start);
+    return sizes;
+}
+
+static void
+test_throughput()
+{
+    constexpr size_t MiB = 1 << 20;
+
+    ChunkThroughput throughput;
+    ASSERT(!throughput.measured());
+    ASSERT(throughput.resolved_speedup() == ChunkThroughput::default_resolved_speedup);
+    throughput.add(false, 8 * MiB, 1, 0);
+    throughput.add(false, 4 * MiB, 1, 0);
+    ASSERT(throughput.measured());
+    ASSERT(throughput.recent_rate() == 6 * MiB);
+    ASSERT(throughput.average_rate() == 6 * MiB);
+    throughput.add(true, 12 * MiB, 1, 0);
+    ASSERT(throughput.resolved_speedup() == 2);
+
+    // The first chunk is scaled by the speedup of resolved chunks
+    ChunkThroughput steady, resolved_fast;
+    for (unsigned i = 0; i < 3; i++) {
+        steady.add(false, 8 * MiB, 1, 0);
+        resolved_fast.add(false, 8 * MiB, 1, 0);
+    }
+    resolved_fast.add(true, 32 * MiB, 1, 0);
+    const auto steady_sizes = first_chunk_sizes(steady);
+    ASSERT(first_chunk_sizes(resolved_fast)[0] > steady_sizes[0]);
+
+    // Chunks shrink when the last chunks decoded slower than the average (highly compressed region)
+    ChunkThroughput slowing;
+    for (unsigned i = 0; i < 2; i++)
+        slowing.add(false, 8 * MiB, 1, 0);
+    slowing.add(false, 1 * MiB, 1, 0);
+    ASSERT(first_chunk_sizes(slowing)[1] < steady_sizes[1]);
+
+    // The compression ratio follows increases immediately, decreases smoothly
+    ChunkThroughput ratio;
+    ASSERT(ratio.ratio() == 0);
+    ratio.add(false, 1 * MiB, 1, 4 * MiB);
+    ASSERT(ratio.ratio() == 4);
+    ratio.add(false, 1 * MiB, 1, 8 * MiB);
+    ASSERT(ratio.ratio() == 8);
+    ratio.add(false, 1 * MiB, 1, 2 * MiB);
+    ASSERT(ratio.ratio() > 2 && ratio.ratio() < 8);
+
+    // Random access chunks are sized for their output to fit their buffer, with a margin
+    ChunkThroughput compressible = steady;
+    compressible.add(false, 8 * MiB, 1, 8 * 20 * MiB);
+    constexpr size_t buffer_symbols = DeflateThreadRandomAccess::buffer_virtual_size / sizeof(uint16_t)
+                                      - DeflateThreadRandomAccess::spill_margin;
+    const size_t     capped_size    = first_chunk_sizes(compressible)[1];
+    ASSERT(capped_size < steady_sizes[1]);
+    ASSERT(capped_size * ChunkScheduler::ratio_margin * 20 <= buffer_symbols);
+}
+
+static void
+test_reserve()
+{
+    const bytes_t     in(64 << 20);
+    const InputStream in_stream(test::as_bytes(in), in.size());
+    ChunkThroughput   throughput;
+    ChunkScheduler    scheduler{in_stream, nullptr, 2, throughput};
+    ChunkTask         first, reserved, other, task;
+
+    // The first chunk decodes with the initial context, it's never reserved
+    ASSERT(!scheduler.reserve(reserved));
+    ASSERT(scheduler.next(first) && first.idx == 0);
+    ASSERT(scheduler.reserve(reserved) && reserved.idx == 1);
+    ASSERT(scheduler.reserve(other) && other.idx == 2);
+    ASSERT(!scheduler.reserve(task)); // As many reserved chunks as threads
+
+    // Reserved chunks are handed out in order once synced, with their first block
+    std::thread waiting([&]() {
+        ASSERT(scheduler.next(task));
+        ASSERT(task.idx == 1 && task.synced_bitpos == 8 * reserved.start + 3);
+        ASSERT(task.upstream == first.downstream);
+    });
+    scheduler.synced(other, ChunkBoundary::unset_stop_pos);
+    scheduler.synced(reserved, 8 * reserved.start + 3);
+    waiting.join();
+    ASSERT(scheduler.next(task) && task.idx == 2 && task.synced_bitpos == ChunkBoundary::unset_stop_pos);
+    ASSERT(scheduler.next(task) && task.idx == 3);
+
+    // Aborting wakes up the workers waiting for a reserved chunk
+    ASSERT(scheduler.reserve(reserved));
+    std::thread aborted([&]() { ASSERT(!scheduler.next(task)); });
+    scheduler.abort();
+    aborted.join();
+}
+
+static void
+test_boundary()
+{
+    using context_t = ChunkBoundary::context_t;
+    const std::vector<uint8_t> context(context_t::context_size, uint8_t('A'));
+
+    ChunkBoundary ready{8 << 20};
+    ASSERT(!ready.context_ready());
+    ready.set_context({context.data(), context.size()}, 1234);
+    ASSERT(ready.context_ready());
+    auto got = ready.get_context();
+    ASSERT(got.second == 1234);
+    ASSERT(got.first && std::equal(context.begin(), context.end(), got.first.begin()));
+
+    // A failed chunk leaves no context, but the next chunk must not wait for it
+    ChunkBoundary failed{8 << 20};
+    failed.fail();
+    ASSERT(failed.context_ready());
+    ASSERT(failed.get_context().second == ChunkBoundary::unset_stop_pos);
+}
+
+/// Symbolic context: even offsets hold characters, odd ones back-references to the context of the base at offset(i)
+template<typename Offset>
+static std::vector<uint16_t>
+symbolic_context(Offset&& offset)
+{
+    std::vector<uint16_t> symbols(ChunkBoundary::context_t::context_size);
+    for (size_t i = 0; i < symbols.size(); i++)
+        symbols[i] = uint16_t(i % 2 == 0 ? 'a' + i % 26 : ChunkBoundary::first_backref_symbol + offset(i));
+    return symbols;
+}
+
+static void
+test_symbolic()
+{
+    using context_t = ChunkBoundary::context_t;
+    std::vector<uint8_t> context(context_t::context_size);
+    for (size_t i = 0; i < context.size(); i++)
+        context[i] = uint8_t('A' + i % 26);
+
+    const auto                  reversed = [](size_t i) { return context_t::context_size - 1 - i; };
+    const auto                  shifted  = [](size_t i) { return (i + 1) % context_t::context_size; };
+    const std::vector<uint16_t> first    = symbolic_context(reversed);
+    const std::vector<uint16_t> second   = symbolic_context(shifted);
+
+    // The contexts of the next chunks are composed as soon as the first one is known
+    ChunkBoundary base{100}, middle{200}, last{300};
+    last.set_symbolic_context({second.data(), second.size()}, &middle, 200, 300);
+    middle.set_symbolic_context({first.data(), first.size()}, &base, 100, 200);
+    ASSERT(!last.context_ready());
+    base.set_context({context.data(), context.size()}, 100);
+    ASSERT(last.context_ready());
+
+    auto got = last.get_context();
+    ASSERT(got.second == 300);
+    for (size_t i = 0; i < context_t::context_size; i++) {
+        uint16_t sym = second[i];
+        if (sym >= ChunkBoundary::first_backref_symbol) sym = first[sym - ChunkBoundary::first_backref_symbol];
+        if (sym >= ChunkBoundary::first_backref_symbol) sym = context[sym - ChunkBoundary::first_backref_symbol];
+        ASSERT(got.first[i] == sym);
+    }
+    // The chunk in the middle resolves its context too, and posts the same one
+    ASSERT(middle.context_ready());
+    middle.set_context({got.first.begin(), got.first.size()}, 200);
+    ASSERT(middle.get_context().second == 200);
+
+    // A function whose base stopped elsewhere is dropped: the context comes from the upstream chunk
+    ChunkBoundary moved_base{100}, moved{200};
+    moved.set_symbolic_context({first.data(), first.size()}, &moved_base, 100, 200);
+    moved_base.set_context({context.data(), context.size()}, 90);
+    ASSERT(!moved.context_ready());
+    moved.set_context({context.data(), context.size()}, 200);
+    ASSERT(moved.context_ready() && moved.get_context().second == 200);
+
+    // So is a function whose base failed
+    ChunkBoundary failed_base{100}, orphan{200};
+    orphan.set_symbolic_context({first.data(), first.size()}, &failed_base, 100, 200);
+    failed_base.fail();
+    ASSERT(!orphan.context_ready());
+    orphan.fail();
+    ASSERT(orphan.context_ready() && orphan.get_context().second == ChunkBoundary::unset_stop_pos);
+}
+
+int
+main()
+{
+    for (unsigned nthreads : {1, 2, 3, 4, 8}) {
+        test_chunks(1 << 20, nthreads);
+        test_chunks(9 << 20, nthreads);
+        test_chunks(200 << 20, nthreads);
+    }
+
+    // No chunk is handed out once aborted
+    const bytes_t     in(64 << 20);
+    const InputStream in_stream(test::as_bytes(in), in.size());
+    ChunkThroughput   throughput;
+    ChunkScheduler    scheduler{in_stream, nullptr, 4, throughput};
+    ChunkTask         task;
+    ASSERT(scheduler.next(task));
+    scheduler.abort();
+    ASSERT(!scheduler.next(task));
+
+    test_throughput();
+    test_reserve();
+    test_boundary();
+    test_symbolic();
+    return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * test_spill.cpp
+ *
+ * Test that a random access chunk whose output overflows its buffer spills:
+ * the end of the chunk is decoded with the context resolved from the buffered
+ * part, and the output is unchanged. The buffers are shrunk so that the chunks
+ * of a small, highly compressible stream overflow them.
+ */
+
+#define PUGZ_RANDOM_ACCESS_BUFFER_SIZE (40ull << 20)
+
+#include "test_util.hpp"
+
+using test::bytes_t;
+
+/// Log-like lines, which compress about 15 times
+static bytes_t
+log_like(size_t nlines)
+{
+    std::mt19937 rng{1};
+    std::string  out;
+    char         line[128];
+    for (size_t i = 0; i < nlines; i++) {
+        snprintf(line,
+                 sizeof(line),
+                 "2019-06-%02u 12:%02u:%02u INFO worker=%u request=%u status=%s\n",
+                 unsigned(1 + i / 1000000 % 28),
+                 unsigned(i / 60000 % 60),
+                 unsigned(i / 1000 % 60),
+                 unsigned(rng() % 4),
+                 unsigned(i),
+                 rng() % 16 ? "200" : "404");
+        out += line;
+    }
+    return {out.begin(), out.end()};
+}
+
+int
+main()
+{
+    const bytes_t data = log_like(2000000);
+    const bytes_t gz   = test::gzip_compress(data);
+    // Each random access chunk outputs more than its buffer holds
+    ASSERT(double(data.size()) / double(gz.size()) * ChunkScheduler::min_chunk_size
+           > DeflateThreadRandomAccess::buffer_virtual_size / 2);
+
+    // With a block map, the chunks stop before they overflow (the first ones, before any ratio is measured, still spill)
+    for (unsigned nthreads : {2, 4}) {
+        for (bool pipelined : {true, false}) {
+            for (bool prescan : {false, true}) {
+                DecompressOptions options;
+                options.nthreads  = nthreads;
+                options.pipelined = pipelined;
+                options.prescan   = prescan;
+
+                DecompressorPool<test::BufferConsumer> pool{options};
+                ASSERT(test::decompress(gz, pool) == data);
+            }
+        }
+    }
+    return 0;
+}
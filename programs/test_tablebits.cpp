@@ -0,0 +1,88 @@
+/*
+ * test_tablebits.cpp
+ *
+ * Test that the litlen table bits of a stream grow with the share of long
+ * litlen codewords, as long as the tables fit the caches, and that every
+ * table size decodes the same output.
+ */
+
+#include "test_util.hpp"
+
+using test::bytes_t;
+
+/// Letters with a few line feeds and rare characters: the rare ones get codewords longer than 12 bits
+static bytes_t
+rare_chars_text(size_t size)
+{
+    std::mt19937 rng{1};
+    bytes_t      out(size);
+    for (auto& c : out) {
+        const unsigned r = rng() % 16384;
+        c                = r < 180 ? '\n' : r < 180 + 90 ? uint8_t('!' + r % 90) : "ACGT"[r % 4];
+    }
+    return out;
+}
+
+/// Lines of 4 letters, which all get short codewords
+static bytes_t
+dna_text(size_t size)
+{
+    std::mt19937 rng{1};
+    bytes_t      out(size);
+    for (size_t i = 0; i < size; i++)
+        out[i] = i % 81 == 80 ? '\n' : "ACGT"[rng() % 4];
+    return out;
+}
+
+static unsigned
+tablebits(const bytes_t& gz, size_t l1d_size, size_t l2_size)
+{
+    InputStream in_stream(test::as_bytes(gz), gz.size());
+    in_stream.consume_header();
+    DeflateParser parser{InputStream{in_stream.in_next, in_stream.available()}};
+    return parser.choose_litlen_tablebits(l1d_size, l2_size);
+}
+
+int
+main()
+{
+    constexpr size_t KiB = 1 << 10, MiB = 1 << 20;
+
+    const bytes_t rare = rare_chars_text(8 * MiB), dna = dna_text(8 * MiB);
+    const bytes_t rare_gz = test::gzip_compress(rare), dna_gz = test::gzip_compress(dna);
+
+    ASSERT(tablebits(rare_gz, 1 * MiB, 16 * MiB) == LITLEN_MAX_TABLEBITS);
+    ASSERT(tablebits(rare_gz, 32 * KiB, 16 * MiB) == 11); // A 12 bits table takes half of the L1D
+    ASSERT(tablebits(rare_gz, 1 * MiB, 64 * KiB) == 11);
+    ASSERT(tablebits(rare_gz, 8 * KiB, 16 * MiB) == LITLEN_MIN_TABLEBITS);
+    ASSERT(tablebits(dna_gz, 1 * MiB, 16 * MiB) == LITLEN_MIN_TABLEBITS);
+
+    // A stream too short to place the input stream on its first block has no sampled block
+    const bytes_t tiny = {'A', '\n'}, tiny_gz = test::gzip_compress(tiny);
+    ASSERT(tablebits(tiny_gz, 1 * MiB, 16 * MiB) == LITLEN_MIN_TABLEBITS);
+
+    // The blocks of each stream are sampled by the same parser of the pool
+    for (unsigned nthreads : {1, 4}) {
+        DecompressOptions options;
+        options.nthreads = nthreads;
+
+        DecompressorPool<test::BufferConsumer> pool{options};
+        ASSERT(test::decompress(rare_gz, pool) == rare);
+        ASSERT(test::decompress(tiny_gz, pool) == tiny);
+        ASSERT(test::decompress(dna_gz, pool) == dna);
+        ASSERT(test::decompress(rare_gz, pool) == rare);
+    }
+
+    for (unsigned bits = LITLEN_MIN_TABLEBITS; bits <= LITLEN_MAX_TABLEBITS; bits++) {
+        for (unsigned nthreads : {1, 4}) {
+            DecompressOptions options;
+            options.nthreads         = nthreads;
+            options.litlen_tablebits = bits;
+
+            DecompressorPool<test::BufferConsumer> pool{options};
+            ASSERT(test::decompress(rare_gz, pool) == rare);
+            ASSERT(test::decompress(dna_gz, pool) == dna);
+        }
+    }
+    return 0;
+}
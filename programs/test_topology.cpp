@@ -0,0 +1,131 @@
+/*
+ * test_topology.cpp
+ *
+ * Test the parsing of the sysfs CPU lists, and that the CPUs chosen for the
+ * workers are allowed ones, node after node, and can be pinned to. Also test
+ * the parsing of the cgroup CPU quotas, which bound the threads of -t auto,
+ * and the detection of the cache sizes.
+ */
+
+#include "test_util.hpp"
+
+#include <algorithm>
+
+/// A temporary file holding text, removed on destruction
+struct TextFile
+{
+    TextFile(const std::string& name, const char* text)
+      : path("pugz_test_" + name)
+    {
+        FILE* f = fopen(path.c_str(), "w");
+        ASSERT(f != nullptr);
+        fputs(text, f);
+        ASSERT(fclose(f) == 0);
+    }
+    TextFile(const TextFile&) = delete;
+    TextFile& operator=(const TextFile&) = delete;
+    ~TextFile() { remove(path.c_str()); }
+
+    std::string path;
+};
+
+static std::vector<unsigned>
+parse_cpulist(const char* text)
+{
+    return topology::read_cpulist(TextFile{"cpulist", text}.path);
+}
+
+static void
+test_cpulist()
+{
+    using list = std::vector<unsigned>;
+    ASSERT(parse_cpulist("0-3,8-9\n") == (list{0, 1, 2, 3, 8, 9}));
+    ASSERT(parse_cpulist("5\n") == list{5});
+    ASSERT(parse_cpulist("0,2,4-5") == (list{0, 2, 4, 5}));
+    ASSERT(parse_cpulist("\n").empty());
+    ASSERT(topology::read_cpulist("pugz_test_missing_cpulist").empty());
+}
+
+static void
+test_worker_cpus()
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    ASSERT(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+    const unsigned nallowed = unsigned(CPU_COUNT(&allowed));
+
+    // Node-major: the workers fill the first node before the next ones
+    std::vector<unsigned> node_major;
+    for (const auto& node : topology::allowed_cpus_by_node())
+        node_major.insert(node_major.end(), node.begin(), node.end());
+    ASSERT(node_major.size() == nallowed);
+
+    // Wraps around when there are more workers than CPUs
+    const auto cpus = topology::worker_cpus(2 * nallowed + 1);
+    ASSERT(cpus.size() == 2 * nallowed + 1);
+    for (size_t i = 0; i < cpus.size(); i++) {
+        ASSERT(CPU_ISSET(cpus[i], &allowed));
+        ASSERT(cpus[i] == node_major[i % nallowed]);
+    }
+
+    ASSERT(topology::pin_thread(cpus.back()));
+    ASSERT(unsigned(sched_getcpu()) == cpus.back());
+}
+
+/// Quota of a cgroup v2 cpu.max file
+static unsigned
+parse_cpu_max(const char* text)
+{
+    return topology::read_cpu_quota(TextFile{"cpu.max", text}.path);
+}
+
+/// Quota of cgroup v1 cpu.cfs_quota_us and cpu.cfs_period_us files
+static unsigned
+parse_cfs_quota(const char* quota, const char* period)
+{
+    const TextFile quota_file{"cpu.cfs_quota_us", quota};
+    const TextFile period_file{"cpu.cfs_period_us", period};
+    return topology::read_cpu_quota(quota_file.path, period_file.path);
+}
+
+static void
+test_cpu_quota()
+{
+    // Rounded up to whole CPUs, 0 when unlimited
+    ASSERT(parse_cpu_max("max 100000\n") == 0);
+    ASSERT(parse_cpu_max("400000 100000\n") == 4);
+    ASSERT(parse_cpu_max("150000 100000\n") == 2);
+    ASSERT(parse_cpu_max("50000 100000\n") == 1);
+    ASSERT(parse_cpu_max("") == 0);
+    ASSERT(parse_cfs_quota("-1\n", "100000\n") == 0);
+    ASSERT(parse_cfs_quota("200000\n", "100000\n") == 2);
+    ASSERT(parse_cfs_quota("200000\n", "") == 0);
+    ASSERT(topology::read_cpu_quota("pugz_test_missing_cpu.max") == 0);
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    ASSERT(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+    const unsigned available = topology::available_cpus();
+    ASSERT(available >= 1 && available <= unsigned(CPU_COUNT(&allowed)));
+}
+
+/// The cache sizes are unknown (0) or plausible, the L2 being larger than the L1D
+static void
+test_cache_sizes()
+{
+    const size_t l1d = topology::data_cache_size(1), l2 = topology::data_cache_size(2);
+    ASSERT(l1d == 0 || (l1d >= (4 << 10) && l1d <= (4 << 20)));
+    ASSERT(l2 == 0 || l2 >= (64 << 10));
+    ASSERT(l1d == 0 || l2 == 0 || l2 > l1d);
+    ASSERT(topology::data_cache_size(9) == 0);
+}
+
+int
+main()
+{
+    test_cpulist();
+    test_cpu_quota();
+    test_worker_cpus();
+    test_cache_sizes();
+    return 0;
+}
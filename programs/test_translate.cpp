@@ -0,0 +1,248 @@
+/*
+ * test_translate.cpp
+ *
+ * Test the translation kernels (lib/translate.hpp): every kernel the CPU
+ * supports gives the same results as the scalar one, on random symbols with
+ * unaligned heads and tails, for lookup tables of any passthrough value.
+ *
+ * Also test that a random access chunk is translated when its context is
+ * resolved, without waiting for its output turn (the previous chunks are not
+ * output yet), and that the chunks are then output in order, and that the
+ * line feeds of 8bits symbols are counted through the lookup table as if they
+ * were translated.
+ */
+
+#include "test_util.hpp"
+
+#include "../lib/translate.hpp"
+
+#include <algorithm>
+#include <random>
+
+using test::bytes_t;
+
+struct named_kernels_t
+{
+    translate::narrow_kernel_t narrow;
+    translate::wide_kernel_t   wide;
+    translate::count_kernel_t  count;
+    const char*                name;
+};
+
+/// The kernels the CPU supports (the scalar ones, as reference, first), nullptr where a set has no kernel
+static std::vector<named_kernels_t>
+supported_kernels()
+{
+    using namespace translate;
+    __builtin_cpu_init();
+    std::vector<named_kernels_t> kernels = {{narrow_scalar, wide_scalar, count_scalar, "scalar"}};
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("popcnt"))
+        kernels.push_back({narrow_avx2, wide_avx2, count_avx2, "avx2"});
+    if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("bmi"))
+        kernels.push_back({nullptr, wide_avx512bw, nullptr, "avx512bw"});
+    if (__builtin_cpu_supports("avx512vbmi") && __builtin_cpu_supports("bmi"))
+        kernels.push_back({narrow_avx512vbmi, nullptr, nullptr, "avx512vbmi"});
+    for (const auto& k : kernels)
+        fprintf(stderr, "testing the %s kernels\n", k.name);
+    return kernels;
+}
+
+/// Random symbols: characters below passthrough, and back-references (below nsyms) with a probability of backref_rate
+template<typename T>
+static std::vector<T>
+random_symbols(std::mt19937& rng, size_t n, unsigned passthrough, unsigned nsyms, double backref_rate)
+{
+    std::bernoulli_distribution backref{backref_rate};
+    std::vector<T>              syms(n);
+    for (T& sym : syms) {
+        if (passthrough == nsyms || !backref(rng))
+            sym = T(rng() % passthrough);
+        else
+            sym = T(passthrough + rng() % (nsyms - passthrough));
+    }
+    return syms;
+}
+
+/// A lookup table of nsyms entries mapping the characters below passthrough to themselves, the others at random
+static std::vector<uint8_t>
+random_table(std::mt19937& rng, unsigned passthrough, unsigned nsyms)
+{
+    std::vector<uint8_t> lkt(nsyms);
+    for (unsigned sym = 0; sym < nsyms; sym++)
+        lkt[sym] = sym < passthrough ? uint8_t(sym) : uint8_t(rng());
+    return lkt;
+}
+
+// Sizes around the 32 and 64 symbols blocks of the kernels, and offsets making the heads unaligned
+static const size_t   sizes[]         = {0, 1, 31, 32, 33, 63, 64, 65, 127, 200, 1000, 4099};
+static const size_t   offsets[]       = {0, 1, 3, 17, 33};
+static const unsigned passthroughs[]  = {1, 2, 10, 128, 129, 200, 255, 256};
+static const double   backref_rates[] = {0, 0.001, 0.05, 0.5, 1};
+
+static void
+test_narrow(const std::vector<named_kernels_t>& kernels, std::mt19937& rng)
+{
+    for (unsigned passthrough : passthroughs) {
+        const std::vector<uint8_t> lkt = random_table(rng, passthrough, 256);
+        for (double rate : backref_rates) {
+            for (size_t size : sizes) {
+                for (size_t offset : offsets) {
+                    const std::vector<uint8_t> syms
+                      = random_symbols<uint8_t>(rng, offset + size, passthrough, 256, rate);
+                    std::vector<uint8_t> expected = syms;
+                    translate::narrow_scalar(expected.data() + offset, size, lkt.data(), passthrough);
+                    for (const auto& k : kernels) {
+                        if (k.narrow == nullptr) continue;
+                        std::vector<uint8_t> data = syms;
+                        k.narrow(data.data() + offset, size, lkt.data(), passthrough);
+                        ASSERT(data == expected);
+                    }
+                    const uint8_t c     = uint8_t(rng());
+                    const size_t  count = translate::count_scalar(syms.data() + offset, size, lkt.data(), c);
+                    for (const auto& k : kernels) {
+                        if (k.count == nullptr) continue;
+                        ASSERT(k.count(syms.data() + offset, size, lkt.data(), c) == count);
+                        // A character present in the data
+                        if (size > 0) {
+                            const uint8_t present = lkt[syms[offset + size / 2]];
+                            ASSERT(k.count(syms.data() + offset, size, lkt.data(), present)
+                                   == translate::count_scalar(syms.data() + offset, size, lkt.data(), present));
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void
+test_wide(const std::vector<named_kernels_t>& kernels, std::mt19937& rng)
+{
+    for (unsigned passthrough : passthroughs) {
+        const unsigned             nsyms = passthrough + (1u << 15); // A back-reference to each byte of a context
+        const std::vector<uint8_t> lkt   = random_table(rng, passthrough, nsyms);
+        for (double rate : backref_rates) {
+            for (size_t size : sizes) {
+                for (size_t offset : offsets) {
+                    const std::vector<uint16_t> syms
+                      = random_symbols<uint16_t>(rng, offset + size, passthrough, nsyms, rate);
+                    std::vector<uint8_t> expected(offset + size, 0xAA);
+                    translate::wide_scalar(
+                      syms.data() + offset, size, expected.data() + offset, lkt.data(), passthrough);
+                    for (const auto& k : kernels) {
+                        if (k.wide == nullptr) continue;
+                        std::vector<uint8_t> out(offset + size, 0xAA);
+                        k.wide(syms.data() + offset, size, out.data() + offset, lkt.data(), passthrough);
+                        ASSERT(out == expected);
+
+                        // In place: the output is written over the start of the input
+                        std::vector<uint16_t> data     = syms;
+                        uint8_t*              in_place = reinterpret_cast<uint8_t*>(data.data() + offset);
+                        k.wide(data.data() + offset, size, in_place, lkt.data(), passthrough);
+                        ASSERT(size == 0 || memcmp(in_place, expected.data() + offset, size) == 0);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/// The dispatched functions use the kernels of the CPU
+static void
+test_dispatch(std::mt19937& rng)
+{
+    fprintf(stderr, "dispatched kernels: %s\n", translate::kernels().name);
+    const std::vector<uint8_t> lkt      = random_table(rng, 100, 256);
+    std::vector<uint8_t>       data     = random_symbols<uint8_t>(rng, 1000, 100, 256, 0.1);
+    std::vector<uint8_t>       expected = data;
+    translate::narrow_scalar(expected.data(), expected.size(), lkt.data(), 100);
+    ASSERT(translate::count({data.data(), data.size()}, {lkt.data(), lkt.size()}, '\n')
+           == size_t(std::count(expected.begin(), expected.end(), '\n')));
+    translate::narrow({data.data(), data.size()}, {lkt.data(), lkt.size()}, 100);
+    ASSERT(data == expected);
+}
+
+static void
+test_count()
+{
+    std::mt19937 rng{1};
+    bytes_t      data(100003), lkt(256);
+    for (auto& sym : data)
+        sym = uint8_t(rng());
+    for (unsigned sym = 0; sym < 256; sym++)
+        lkt[sym] = uint8_t(sym < 128 ? sym : rng() % 128); // Back-references translating to any character
+
+    for (size_t n : {size_t(0), size_t(31), size_t(32), size_t(1000), data.size()}) {
+        const size_t expected = translate::count_scalar(data.data(), n, lkt.data(), '\n');
+        ASSERT(translate::count({data.data(), n}, {lkt.data(), lkt.size()}, '\n') == expected);
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+            ASSERT(translate::count_avx2(data.data(), n, lkt.data(), '\n') == expected);
+    }
+}
+
+/// Resolve the context of the second chunk of a stream before the first chunk is output
+static void
+test_resolve()
+{
+    const bytes_t data = test::fastq_like(100000);
+    const bytes_t gz   = test::gzip_compress(data);
+
+    InputStream header_stream(test::as_bytes(gz), gz.size());
+    header_stream.consume_header();
+    const InputStream in_stream(header_stream.in_next, header_stream.available());
+
+    bytes_t                               out;
+    test::BufferConsumer                  consumer{&out};
+    ConsumerSync                          sync{};
+    ConsumerWrapper<test::BufferConsumer> wrapper{consumer, &sync}, tail_wrapper{consumer, &sync};
+    wrapper.set_chunk_idx(0);
+    tail_wrapper.set_chunk_idx(1, true);
+
+    // The second chunk decodes from the middle of the stream
+    ChunkBoundary             boundary, end;
+    DeflateThreadRandomAccess tail{in_stream, tail_wrapper};
+    tail.set_upstream(&boundary);
+    tail.set_downstream(&end);
+    tail.decode(4 * in_stream.size(), []() {});
+    const size_t block_pos = boundary.get_stop_pos();
+
+    // Its context, from a decoder that doesn't output
+    bytes_t                               context_out;
+    test::BufferConsumer                  context_consumer{&context_out};
+    ConsumerWrapper<test::BufferConsumer> context_wrapper{context_consumer};
+    ChunkBoundary                         context_boundary{block_pos};
+    DeflateThread                         context_decoder{in_stream, context_wrapper};
+    context_decoder.set_downstream(&context_boundary);
+    context_decoder.go(0);
+    auto context = context_boundary.get_context();
+    ASSERT(context.second == block_pos);
+    boundary.set_context({context.first.begin(), context.first.size()}, context.second);
+
+    // Translated while the first chunk holds the output turn
+    ASSERT(!tail_wrapper.output_ready());
+    ASSERT(tail.resolve_context());
+    ASSERT(out.empty());
+
+    ChunkBoundary head_boundary{block_pos};
+    DeflateThread head{in_stream, wrapper};
+    head.set_downstream(&head_boundary);
+    head.go(0);
+    ASSERT(out.size() == context_out.size());
+    ASSERT(tail_wrapper.output_ready());
+
+    tail.flush();
+    ASSERT(out == data);
+}
+
+int
+main()
+{
+    const std::vector<named_kernels_t> kernels = supported_kernels();
+    std::mt19937                       rng{1};
+    test_narrow(kernels, rng);
+    test_wide(kernels, rng);
+    test_dispatch(rng);
+    test_resolve();
+    test_count();
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * test_util.hpp - utility functions for the pugz test programs
+ *
+ * The pugz decompressor is header only: the tests include it directly, and use
+ * zlib to write the gzip streams they decompress.
+ */
+
+#ifndef PROGRAMS_TEST_UTIL_HPP
+#define PROGRAMS_TEST_UTIL_HPP
+
+#include "../lib/gzip_decompress.hpp" //FIXME
+
+#include <zlib.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#define ASSERT(expr)                                                                                                   \
+    {                                                                                                                  \
+        if (unlikely(!(expr))) test::assertion_failed(#expr, __FILE__, __LINE__);                                      \
+    }
+
+namespace test {
+
+using bytes_t = std::vector<uint8_t>;
+
+[[noreturn]] inline void
+assertion_failed(const char* expr, const char* file, int line)
+{
+    fprintf(stderr, "Assertion failed: %s at %s:%d\n", expr, file, line);
+    abort();
+}
+
+inline const byte*
+as_bytes(const bytes_t& data)
+{
+    return reinterpret_cast<const byte*>(data.data());
+}
+
+/// Compress data to a gzip stream with zlib, strategy is one of the Z_* strategies (Z_FIXED for fixed Huffman blocks)
+inline bytes_t
+gzip_compress(const bytes_t& data, int level = 6, int strategy = Z_DEFAULT_STRATEGY)
+{
+    z_stream strm = {};
+    ASSERT(deflateInit2(&strm, level, Z_DEFLATED, 15 + 16, 8, strategy) == Z_OK);
+    bytes_t out(deflateBound(&strm, uLong(data.size())));
+    strm.next_in   = const_cast<Bytef*>(data.data());
+    strm.avail_in  = uInt(data.size());
+    strm.next_out  = out.data();
+    strm.avail_out = uInt(out.size());
+    ASSERT(deflate(&strm, Z_FINISH) == Z_STREAM_END);
+    out.resize(strm.total_out);
+    deflateEnd(&strm);
+    return out;
+}
+
+/// FASTQ-like records: nreads records of 4 lines, drawn from a small vocabulary so that they compress like real reads
+inline bytes_t
+fastq_like(size_t nreads, uint32_t seed = 1)
+{
+    std::mt19937                          rng{seed};
+    std::uniform_int_distribution<size_t> word_dist{0, 255};
+    std::vector<std::string>              words;
+    for (unsigned i = 0; i < 256; i++) {
+        std::string word;
+        for (unsigned j = 0; j < 4 + rng() % 8; j++)
+            word += "ACGT"[rng() % 4];
+        words.push_back(word);
+    }
+
+    std::string out;
+    for (size_t read = 0; read < nreads; read++) {
+        std::string seq;
+        while (seq.size() < 100)
+            seq += words[word_dist(rng)];
+        seq.resize(100);
+        out += "@read" + std::to_string(read) + " lane:" + std::to_string(rng() % 8) + "\n" + seq + "\n+\n";
+        for (char c : seq)
+            out += char('!' + (c * 7 + rng() % 5) % 41);
+        out += "\n";
+    }
+    return {out.begin(), out.end()};
+}
+
+/// Collects the output of a decompression in a buffer
+struct BufferConsumer
+{
+    void operator()(span<const uint8_t> data) { out->insert(out->end(), data.begin(), data.end()); }
+
+    bytes_t* out;
+};
+
+/// Decompress a gzip stream in order with a pool, using (or building) an index if not null
+inline bytes_t
+decompress(const bytes_t&                    gz,
+           DecompressorPool<BufferConsumer>& pool,
+           const ChunkIndex*                 index       = nullptr,
+           ChunkIndex*                       build_index = nullptr)
+{
+    bytes_t        out;
+    BufferConsumer consumer{&out};
+    ConsumerSync   sync{};
+    pool.decompress(as_bytes(gz), gz.size(), consumer, &sync, index, build_index);
+    return out;
+}
+
+/// Decompress a gzip stream in order with nthreads, using (or building) an index if not null
+inline bytes_t
+decompress(const bytes_t&    gz,
+           unsigned          nthreads,
+           const ChunkIndex* index       = nullptr,
+           ChunkIndex*       build_index = nullptr,
+           bool              sketches    = false)
+{
+    DecompressOptions options;
+    options.nthreads       = nthreads;
+    options.index_sketches = sketches;
+
+    DecompressorPool<BufferConsumer> pool{options};
+    return decompress(gz, pool, index, build_index);
+}
+
+/// A path for a temporary file of the test, removed on destruction
+class TempFile
+{
+  public:
+    explicit TempFile(const std::string& name)
+      : _path("pugz_test_" + name)
+    {}
+    TempFile(const TempFile&) = delete;
+    TempFile& operator=(const TempFile&) = delete;
+    ~TempFile() { remove(_path.c_str()); }
+
+    const char* path() const { return _path.c_str(); }
+
+    void write(const bytes_t& data) const
+    {
+        FILE* f = fopen(path(), "wb");
+        ASSERT(f != nullptr);
+        ASSERT(data.empty() || fwrite(data.data(), data.size(), 1, f) == 1);
+        ASSERT(fclose(f) == 0);
+    }
+
+    bytes_t read() const
+    {
+        FILE* f = fopen(path(), "rb");
+        ASSERT(f != nullptr);
+        bytes_t data;
+        int     c;
+        while ((c = fgetc(f)) != EOF)
+            data.push_back(uint8_t(c));
+        fclose(f);
+        return data;
+    }
+
+  private:
+    std::string _path;
+};
+
+} // namespace test
+
+#endif // PROGRAMS_TEST_UTIL_HPP
@@ -0,0 +1,218 @@
+#!/bin/bash
+#
+# Test script for the pugz gunzip program, against the original data and
+# wc -l, and for the options that use an index (FILE.pugzi), against a plain
+# decompression of the same file, sed -n and grep -F.
+#
+# To run, you must set GUNZIP in the environment to the absolute path to the
+# pugz gunzip program to test.  The test data is generated, and compressed
+# with the gzip found in the PATH.
+#
+
+set -eu -o pipefail
+
+export -n GUNZIP
+
+TMPDIR="$(mktemp -d)"
+CURRENT_TEST=
+
+cleanup() {
+	if [ -n "$CURRENT_TEST" ]; then
+		echo "TEST FAILED: \"$CURRENT_TEST\""
+	fi
+	rm -rf -- "$TMPDIR"
+}
+
+trap cleanup EXIT
+
+begin_test() {
+	CURRENT_TEST="$1"
+	rm -f -- "$TMPDIR"/*.pugzi
+}
+
+gunzip() {
+	$GUNZIP "$@" 2>/dev/null
+}
+
+assert_equals() {
+	local expected="$1"
+	local actual="$2"
+
+	if [ "$expected" != "$actual" ]; then
+		echo "Expected '$expected', but got '$actual'"
+		return 1
+	fi
+}
+
+cd "$TMPDIR"
+
+# FASTQ-like reads, large enough to be split in several chunks with 4 threads
+awk 'BEGIN {
+	srand(1)
+	for (r = 0; r < 80000; r++) {
+		s = ""; q = ""
+		for (j = 0; j < 100; j++) {
+			s = s substr("ACGT", int(rand() * 4) + 1, 1)
+			q = q sprintf("%c", 33 + int(rand() * 41))
+		}
+		printf "@read%d lane:%d\n%s\n+\n%s\n", r, r % 8, s, q
+	}
+}' > file
+gzip -c file > file.gz
+tac file > file2
+gzip -c file2 > file2.gz
+printf 'other\n' | gzip -c > other.gz
+# Repetitive log lines: most line feeds are back-references in the random access chunks
+awk 'BEGIN {
+	srand(2)
+	for (r = 0; r < 600000; r++)
+		printf "2019-06-01 12:%02d:%02d INFO worker=%d request=%d id=%08x\n", r / 6000 % 60, r / 100 % 60, r % 4, r, int(rand() * 4294967296)
+}' > log
+gzip -c log > log.gz
+
+
+begin_test 'Plain decompression'
+for t in 1 2 3 4 8; do
+	gunzip -t $t file.gz | cmp - file
+done
+
+
+begin_test '-s decodes one chunk at a time per thread'
+for t in 2 4 8; do
+	gunzip -t $t -s file.gz | cmp - file
+done
+
+
+begin_test '-t auto chooses the number of threads'
+gunzip -t auto file.gz | cmp - file
+gunzip -t auto other.gz | cmp - <(printf 'other\n')
+
+
+begin_test 'Outputs smaller than a window'
+for t in 1 4; do
+	gunzip -t $t other.gz | cmp - <(printf 'other\n')
+	assert_equals 1 "$(gunzip -t $t -l other.gz)"
+done
+
+
+begin_test '-p pins the threads'
+for t in 1 4; do
+	gunzip -t $t -p file.gz | cmp - file
+done
+
+
+begin_test 'Several files are decompressed by the same threads'
+for t in 1 4; do
+	gunzip -t $t file.gz other.gz file2.gz file.gz | cmp - <(cat file <(printf 'other\n') file2 file)
+	gunzip -t $t -s file2.gz file.gz | cmp - <(cat file2 file)
+done
+
+
+begin_test '-l counts the lines'
+for t in 1 4; do
+	assert_equals "$(wc -l < file)" "$(gunzip -t $t -l file.gz)"
+	assert_equals "$(wc -l < file)" "$(gunzip -t $t -s -l file.gz)"
+	assert_equals "$(printf '%s\n' $(wc -l < file) 1 $(wc -l < file2))" "$(gunzip -t $t -l file.gz other.gz file2.gz)"
+done
+for t in 2 4 8; do
+	assert_equals "$(wc -l < log)" "$(gunzip -t $t -l log.gz)"
+	assert_equals "$(wc -l < log)" "$(gunzip -t $t -s -l log.gz)"
+	assert_equals "$(wc -l < log)" "$(gunzip -t $t -b -l log.gz)"
+done
+
+
+begin_test '-H counts the bytes'
+gunzip -t 1 -H file.gz > counts
+assert_equals "$(wc -c < file)" "$(awk '{ n += $2 } END { print n }' counts)"
+assert_equals "$(wc -l < file)" "$(awk '$1 == 10 { print $2 }' counts)"
+for t in 2 4 8; do
+	gunzip -t $t -H file.gz | cmp - counts
+	gunzip -t $t -s -H file.gz | cmp - counts
+	gunzip -t $t -b -H file.gz | cmp - counts
+done
+
+
+begin_test '-b maps the blocks first'
+for t in 2 4 8; do
+	gunzip -t $t -b file.gz | cmp - file
+	gunzip -t $t -b -s file.gz | cmp - file
+	assert_equals "$(wc -l < file)" "$(gunzip -t $t -b -l file.gz)"
+done
+gunzip -t 4 -b file.gz other.gz file2.gz | cmp - <(cat file <(printf 'other\n') file2)
+
+
+begin_test '-I only builds the index'
+assert_equals 0 "$(gunzip -t 4 -I file.gz | wc -c)"
+[ -s file.gz.pugzi ]
+
+
+begin_test '-i decompresses from the index'
+gunzip -t 4 -I file.gz
+cp file.gz.pugzi index
+for t in 1 2 4 8; do
+	gunzip -t $t -i file.gz | cmp - file
+	cmp file.gz.pugzi index
+done
+
+
+begin_test '-i builds a missing index while decompressing'
+gunzip -t 4 -i file.gz | cmp - file
+[ -s file.gz.pugzi ]
+gunzip -t 4 -i file.gz | cmp - file
+
+
+begin_test '-i rebuilds a stale index'
+gunzip -t 4 -I other.gz
+cp other.gz.pugzi file.gz.pugzi
+gunzip -t 4 -i file.gz | cmp - file
+if cmp -s file.gz.pugzi other.gz.pugzi; then
+	exit 1
+fi
+gunzip -t 4 -i file.gz | cmp - file
+
+
+begin_test '-i rebuilds a truncated index'
+gunzip -t 4 -I file.gz
+truncate -s -1 file.gz.pugzi
+truncated_size=$(stat -c %s file.gz.pugzi)
+gunzip -t 4 -i file.gz | cmp - file
+[ "$(stat -c %s file.gz.pugzi)" != "$truncated_size" ]
+gunzip -t 4 -i file.gz | cmp - file
+
+
+begin_test '-I indexes the same chunks with any number of threads'
+gunzip -t 4 -I file.gz
+mv file.gz.pugzi index
+gunzip -t 1 -I file.gz
+assert_equals "$(stat -c %s index)" "$(stat -c %s file.gz.pugzi)"
+[ "$(stat -c %s index)" -gt 65536 ] # More than one chunk of 32KiB
+gunzip -t 1 -L 77777:77790 file.gz | cmp - <(sed -n 77777,77790p file)
+
+
+begin_test '-L m:n outputs the lines of sed -n m,np'
+# Within a chunk, over the whole file, to its end, past its end, and ending before starting (line m only)
+for range in 1 1:1 2:5 77777:77790 1000:300000 1: 319990: 319995:400000 400000:400010 10:5 400010:5; do
+	address=${range/:/,}
+	if [ "${address: -1}" = , ]; then
+		address+='$'
+	fi
+	gunzip -t 4 -L $range file.gz | cmp - <(sed -n "${address}p" file) \
+		|| { echo "-L $range"; exit 1; }
+done
+for range in 0:5 5:x x; do
+	if gunzip -L $range file.gz; then
+		echo "-L $range"; exit 1
+	fi
+done
+
+
+begin_test '-g str outputs the lines of grep -F str'
+for pattern in '@read12345 ' '@read79999 ' 'lane:3' 'GT' 'ZZZZZ'; do
+	for t in 1 4; do
+		gunzip -t $t -g "$pattern" file.gz | cmp - <(grep -F -- "$pattern" file || true) \
+			|| { echo "-g '$pattern'"; exit 1; }
+	done
+done
+
+
+CURRENT_TEST=